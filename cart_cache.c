@@ -9,16 +9,49 @@
 //
 
 // Includes
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 // Project Includes
 #include <cart_driver.h>
 #include <cart_cache.h>
 #include <cart_controller.h>
 #include <cmpsc311_log.h> 
+#include <cmpsc311_util.h>
 
 // Defines
+#if CART_CACHE_STATS
+#define CACHE_STAT(stmt) do { stmt; } while(0) // instrumentation, compiled out with -DCART_CACHE_STATS=0
+#else
+#define CACHE_STAT(stmt)
+#endif
+#define CACHE_MIN_BUCKETS 16 // smallest hash index, always a power of 2
+#define CACHE_HASH_MUL 2654435761u // Fibonacci hashing multiplier, 2^32/golden ratio
+#define CACHE_NIL -1 // null index for the node links
+#define CACHE_MAX_FRAMES 0x1000000 // largest cache a byte budget can ask for
+#define CACHE_MIN_FRAMES 16 // the memory controller will not shrink below this
+#define CACHE_RSS_CHECK 1024 // operations between checks of the process memory
+#define CACHE_RSS_SLACK 8 // a shrink gives back 1/CACHE_RSS_SLACK of the arena extra
+#define CACHE_MAX_LISTS 5 // policy lists plus the admission window
+#define CACHE_MAX_PINS 16 // frames pinned at once, spare pool frames cover them
+#define SKETCH_DEPTH 4 // rows (hash functions) in the admission sketch
+#define SKETCH_WIDTH_FACTOR 4 // counters per row for each frame in the cache
+#define SKETCH_MAX_COUNT 15 // counters are 4 bits, two per byte
+#define SKETCH_SAMPLE 10 // age the sketch every SKETCH_SAMPLE*width additions
+#define CACHE_WINDOW_PERCENT 5 // share of the frames in the admission window
+#define CACHE_SNAPSHOT_DEFAULT 1000 // operations between stats snapshots
+#define CACHE_TEST_SIZE 64 // frames in the unit test cache
+#define CACHE_TEST_FRAMES 256 // distinct frames touched by the unit test
+#define CACHE_TEST_OPS 100000 // get/put operations in the unit test
+#define CACHE_TEST_HOT 16 // frames in the unit test hot set
+#define CACHE_TEST_SCAN 1000 // frames in the unit test sequential scan
+#define CACHE_TEST_REFS 4 // references to each hot frame in the admission test
+#define CACHE_TEST_STRIDE 8 // streamed frames between hot references
+#define CACHE_TEST_L2_FILE "cart_cache_l2.tst" // second tier file of the unit test
 
 //
 // Functions
@@ -27,334 +60,2627 @@
 {
 	uint32_t file_num;// file num of the frame
 
-	struct cache_node *prev, *next;//pointers to the prev and next nodes
+	int32_t prev, next;//indices of the prev and next nodes
 
-	char frame[1024];//actual data in the cache
+	int32_t hnext;//index of the next node in the same hash bucket
 
-}cache_node; // node in a double linked list for LRU Cache
+	int32_t frame;//index in the frame pool, CACHE_NIL for a ghost entry
+
+	int8_t list;//which policy list the node is on
+
+	int8_t dirty;//1 if the frame is newer than the cartridge (write-back)
+
+}cache_node; // node in a double linked list of the replacement policy
+
+typedef struct cache_list
+{
+	int32_t start, end; // most and least recently used ends
+
+	int32_t size; // number of nodes on the list
+
+}cache_list;
+
+typedef struct cache_pin
+{
+	uint16_t count; // outstanding pins on the pool frame
+
+	uint8_t orphan; // 1 if evicted while pinned, freed on the last unpin
+
+}cache_pin;
+
+typedef struct cache_layout
+{
+	uint32_t nnodes, nframes; // node and pool frame counts
+
+	uint32_t buckets, sketchBits; // hash buckets, log2 of the sketch row width
+
+	size_t fbytes, nbytes, sbytes, xbytes, tbytes, pbytes, kbytes; // size of each piece
+
+}cache_layout; // how a cache of some size is laid out in its arena
+
+typedef struct l2_node
+{
+	uint32_t file_num; // frame held in this slot of the file
+
+	int32_t prev, next; // LRU list of the used slots, free chain through next
+
+	int32_t hnext; // next slot in the same hash bucket
+
+}l2_node; // one slot of the second tier
+
+typedef struct cache_l2
+{
+	int fd; // backing file, -1 if there is no second tier
+
+	char *map; // the file mapped, frames * CART_FRAME_SIZE bytes
+
+	int32_t frames; // slots in the file
+
+	l2_node *nodes; // one per slot
+
+	int32_t *table; // hash index of the slots keyed on file_num
+
+	uint32_t shift; // 32 - log2(buckets)
+
+	int32_t start, end; // most and least recently demoted slots
+
+	int32_t freeSlot; // first unused slot, chained through next
+
+}cache_l2; // victim tier, clean evicted frames in a mapped local file
 
 typedef struct Cache
  {  int8_t flag; //1 if power is on  or 0 if power is off
 
-	int32_t max; // max number of frames in the cache
-	
-	int32_t cap; //capacity in the structure... should never be > max 
-	
-	cache_node *start, *end;
+	int32_t max; // max number of frames in the cache
+
+	int32_t cap; //capacity in the structure... should never be > max 
+
+	cache_list lists[CACHE_MAX_LISTS]; // policy lists, resident and ghost
+
+	int32_t p; // ARC target size of T1
+
+	int32_t pmax; // frames managed by the replacement policy (max less the window)
+
+	int32_t wmax; // frames in the admission window, 0 without admission
+
+	void *arena; // single mapping holding frames, nodes and table
+
+	size_t arenaBytes; // size of the arena mapping
+
+	char *frames; // page aligned frame pool, nframes * CART_FRAME_SIZE bytes
+
+	int32_t nframes; // pool frames, max plus CACHE_MAX_PINS spares for pinned evictions
+
+	cache_node *nodes; // dense metadata array, 2*max entries (room for ghosts)
+
+	int32_t *table; // hash index of the nodes keyed on file_num
+
+	uint32_t shift; // 32 - log2(buckets), buckets is a power of 2
+
+	int32_t freeNode; // first unused node, chained through next
+
+	int32_t *freeFrames; // stack of unused frame pool slots
+
+	int32_t nFreeFrames; // depth of the freeFrames stack
+
+	cache_pin *pins; // pin state of each pool frame
+
+	int32_t npinned; // pool frames with a pin outstanding
+
+	uint8_t *sketch; // TinyLFU count-min sketch, SKETCH_DEPTH rows of 4 bit counters
+
+	uint32_t sketchBits; // log2 of the counters per row
+
+	uint32_t sketchAdds, sketchSample; // additions since aging, additions per aging
+
+	int32_t *scratch; // max node indices, used to sort dirty frames for a sync
+
+	int32_t ndirty; // resident frames waiting to be written back
+
+	int8_t flushFailed; // set when a write back fails, reported by the caller
+
+	uint32_t rssTick; // operations since the memory controller last looked
+
+	int8_t moving; // set while a frame changes lists, its release is not an eviction
+
+	cache_l2 l2; // second tier the evicted frames go to
+
+ }Cache;
+
+typedef struct cache_policy
+{
+	const char *name; // name used to select the policy
+
+	void (*hit)(int32_t n); // resident node n was referenced
+
+	int32_t (*miss)(uint32_t file_num, int32_t n); // bring file_num in, n is its ghost or CACHE_NIL
+
+	int32_t (*victim)(void); // resident node the next miss on a full cache evicts
+
+	void (*trim)(void); // drop ghosts and clamp state after pmax shrinks
+
+}cache_policy; // replacement policy operations
+
+ // initialize the cache globally since i cant pass the pointer around
+Cache* cache=NULL;
+
+// writes a frame to the cartridges, registered by the driver
+int (*flusher)(uint32_t file_num, void *frame)=NULL;
+
+int writeback=0; // 1 if writes stay dirty in the cache until evicted/synced
+
+size_t rssLimit=0; // process memory ceiling for the cache controller, 0 for none
+
+char *l2Path=NULL; // file backing the second tier, NULL for none
+uint32_t l2Frames=0; // frames the second tier holds
+
+// instrumentation, kept outside the cache so it can be read after close
+CartCacheStats stats;
+uint32_t snapshotEvery=CACHE_SNAPSHOT_DEFAULT; // operations between snapshots
+void (*snapshotter)(const CartCacheStats *stats)=NULL; // gets each snapshot
+
+// list ids used by the policies
+enum { LRU_LIST=0 };
+enum { ARC_T1=0, ARC_T2=1, ARC_B1=2, ARC_B2=3 };
+enum { Q2_A1IN=0, Q2_AM=1, Q2_A1OUT=2 };
+enum { CACHE_WINDOW=CACHE_MAX_LISTS-1 };
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frameOf
+// Description  : get the frame storage owned by a node
+//
+// Inputs       : n - the node index
+// Outputs      : pointer to the CART_FRAME_SIZE bytes of the node
+
+char* frameOf(int32_t n)
+{
+	return(cache->frames + (size_t)cache->nodes[n].frame*CART_FRAME_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashBucket
+// Description  : pick the bucket of a file_num. The key is mixed first: frame k
+//                of every cart has the same low bits, so a plain mask would
+//                put all of them in one bucket
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+//                shift - 32 - log2(buckets) of the index
+// Outputs      : the bucket
+
+uint32_t hashBucket(uint32_t file_num, uint32_t shift)
+{
+	return((file_num*CACHE_HASH_MUL)>>shift);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashFind
+// Description  : find the node holding file_num through the hash index
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the node index or CACHE_NIL if not in the cache
+
+int32_t hashFind(uint32_t file_num)
+{
+	int32_t n=cache->table[hashBucket(file_num,cache->shift)];
+
+	while(n!=CACHE_NIL && cache->nodes[n].file_num!=file_num)
+		n=cache->nodes[n].hnext;
+
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashInsert
+// Description  : add a node to the front of its hash bucket
+//
+// Inputs       : n - the node index to add to the index
+// Outputs      : none
+
+void hashInsert(int32_t n)
+{
+	int32_t* head=&cache->table[hashBucket(cache->nodes[n].file_num,cache->shift)];
+
+	cache->nodes[n].hnext=*head;
+	*head=n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashRemove
+// Description  : take a node out of its hash bucket
+//
+// Inputs       : n - the node index to remove from the index
+// Outputs      : none
+
+void hashRemove(int32_t n)
+{
+	int32_t* link=&cache->table[hashBucket(cache->nodes[n].file_num,cache->shift)];
+
+	while(*link!=CACHE_NIL && *link!=n)
+		link=&cache->nodes[*link].hnext;
+
+	if(*link==n)
+		*link=cache->nodes[n].hnext;
+	cache->nodes[n].hnext=CACHE_NIL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkNode
+// Description  : take a node off its policy list, fixing up start and end
+//
+// Inputs       : n - the node index to unlink
+// Outputs      : none
+
+void unlinkNode(int32_t n)
+{
+	cache_node* node=&cache->nodes[n];
+	cache_list* l=&cache->lists[node->list];
+
+	if(node->prev!=CACHE_NIL)
+		cache->nodes[node->prev].next=node->next;
+	else
+		l->start=node->next;
+
+	if(node->next!=CACHE_NIL)
+		cache->nodes[node->next].prev=node->prev;
+	else
+		l->end=node->prev;
+
+	node->prev=node->next=CACHE_NIL;
+	l->size--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pushFront
+// Description  : put a node at the start (most recently used) of a list
+//
+// Inputs       : list - the list id to push onto
+//                n - the node index to push
+// Outputs      : none
+
+void pushFront(int list, int32_t n)
+{
+	cache_list* l=&cache->lists[list];
+
+	cache->nodes[n].list=list;
+	cache->nodes[n].prev=CACHE_NIL;
+	cache->nodes[n].next=l->start;
+
+	if(l->start!=CACHE_NIL)
+		cache->nodes[l->start].prev=n;
+	else
+		l->end=n;
+
+	l->start=n;
+	l->size++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : moveFront
+// Description  : move a node from wherever it is to the start of a list
+//
+// Inputs       : list - the list id to move to
+//                n - the node index to move
+// Outputs      : none
+
+void moveFront(int list, int32_t n)
+{
+	if(cache->nodes[n].list==list && cache->lists[list].start==n)
+		return;
+
+	unlinkNode(n);
+	pushFront(list,n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : newNode
+// Description  : take an unused node for file_num and put it in the hash index
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the node index (not on any list, no frame)
+
+int32_t newNode(uint32_t file_num)
+{
+	int32_t n=cache->freeNode;
+
+	cache->freeNode=cache->nodes[n].next;
+	cache->nodes[n].file_num=file_num;
+	cache->nodes[n].frame=CACHE_NIL;
+	cache->nodes[n].dirty=0;
+	cache->nodes[n].prev=cache->nodes[n].next=CACHE_NIL;
+	hashInsert(n);
+
+	return(n);
+}
+
+//
+// Second tier (victim cache in a mapped file)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Find
+// Description  : find the slot holding file_num in the second tier
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the slot or CACHE_NIL if not there
+
+int32_t l2Find(uint32_t file_num)
+{
+	cache_l2 *t=&cache->l2;
+	int32_t n;
+
+	if(t->frames==0)
+		return(CACHE_NIL);
+
+	n=t->table[hashBucket(file_num,t->shift)];
+	while(n!=CACHE_NIL && t->nodes[n].file_num!=file_num)
+		n=t->nodes[n].hnext;
+
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Remove
+// Description  : take a slot out of the index and the LRU list, freeing it
+//
+// Inputs       : n - the slot
+// Outputs      : none
+
+void l2Remove(int32_t n)
+{
+	cache_l2 *t=&cache->l2;
+	l2_node *node=&t->nodes[n];
+	int32_t *link=&t->table[hashBucket(node->file_num,t->shift)];
+
+	while(*link!=n)
+		link=&t->nodes[*link].hnext;
+	*link=node->hnext;
+
+	if(node->prev!=CACHE_NIL)
+		t->nodes[node->prev].next=node->next;
+	else
+		t->start=node->next;
+	if(node->next!=CACHE_NIL)
+		t->nodes[node->next].prev=node->prev;
+	else
+		t->end=node->prev;
+
+	node->next=t->freeSlot;
+	t->freeSlot=n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Demote
+// Description  : keep a clean frame leaving the cache in the second tier,
+//                pushing out the least recently demoted slot if it is full
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+//                frame - the frame contents
+// Outputs      : none
+
+void l2Demote(uint32_t file_num, char *frame)
+{
+	cache_l2 *t=&cache->l2;
+	int32_t n, *head;
+
+	if(t->frames==0)
+		return;
+
+	if((n=l2Find(file_num))!=CACHE_NIL)//an old copy, replace it
+		l2Remove(n);
+	if(t->freeSlot==CACHE_NIL)
+		l2Remove(t->end);
+
+	n=t->freeSlot;
+	t->freeSlot=t->nodes[n].next;
+	t->nodes[n].file_num=file_num;
+	head=&t->table[hashBucket(file_num,t->shift)];
+	t->nodes[n].hnext=*head;
+	*head=n;
+
+	t->nodes[n].prev=CACHE_NIL;
+	t->nodes[n].next=t->start;
+	if(t->start!=CACHE_NIL)
+		t->nodes[t->start].prev=n;
+	else
+		t->end=n;
+	t->start=n;
+
+	memcpy(t->map+(size_t)n*CART_FRAME_SIZE,frame,CART_FRAME_SIZE);
+	CACHE_STAT(stats.demotions++);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Open
+// Description  : create and map the second tier file, set up its index
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int l2Open(void)
+{
+	cache_l2 *t=&cache->l2;
+	size_t bytes=(size_t)l2Frames*CART_FRAME_SIZE;
+	uint32_t buckets, i;
+
+	memset(t,0,sizeof(cache_l2));
+	t->fd=-1;
+	t->start=t->end=t->freeSlot=CACHE_NIL;
+	if(l2Path==NULL || l2Frames==0)
+		return(0);
+
+	t->fd=open(l2Path,O_RDWR|O_CREAT|O_TRUNC,0600);
+	if(t->fd<0 || ftruncate(t->fd,bytes)!=0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in init cache, cannot create second tier file [%s]",l2Path);
+		return(-1);
+	}
+	t->map=mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,t->fd,0);
+	if(t->map==MAP_FAILED)
+	{
+		t->map=NULL;
+		logMessage(LOG_ERROR_LEVEL,"Error in init cache, cannot map second tier file [%s]",l2Path);
+		return(-1);
+	}
+
+	for(buckets=CACHE_MIN_BUCKETS; buckets<l2Frames; buckets<<=1);
+	t->nodes=(l2_node*)malloc((size_t)l2Frames*sizeof(l2_node));
+	t->table=(int32_t*)malloc((size_t)buckets*sizeof(int32_t));
+	if(t->nodes==NULL || t->table==NULL)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in init cache, second tier index allocation failed");
+		return(-1);
+	}
+	for(i=0;i<buckets;i++)
+		t->table[i]=CACHE_NIL;
+	for(t->shift=32;(1u<<(32-t->shift))<buckets;t->shift--);
+	for(i=0;i<l2Frames;i++)
+		t->nodes[i].next=(i+1<l2Frames) ? (int32_t)i+1 : CACHE_NIL;
+	t->freeSlot=0;
+	t->frames=l2Frames;
+
+	logMessage(LOG_INFO_LEVEL,"Cache second tier of %u frames in [%s]",l2Frames,l2Path);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Close
+// Description  : unmap and remove the second tier file, free its index
+//
+// Inputs       : none
+// Outputs      : none
+
+void l2Close(void)
+{
+	cache_l2 *t=&cache->l2;
+
+	if(t->map!=NULL)
+		munmap(t->map,(size_t)l2Frames*CART_FRAME_SIZE);
+	if(t->fd>=0)
+	{
+		close(t->fd);
+		unlink(l2Path);//its contents only mean something to this cache
+	}
+	free(t->nodes);
+	free(t->table);
+	memset(t,0,sizeof(cache_l2));
+	t->fd=-1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushNode
+// Description  : write a dirty frame back to the cartridges, marking it clean
+//                (it stays dirty if the write back fails)
+//
+// Inputs       : n - the resident node index
+// Outputs      : 0 if successful, -1 if failure
+
+int flushNode(int32_t n)
+{
+	if(!cache->nodes[n].dirty)
+		return(0);
+
+	cache->nodes[n].dirty=0;
+	cache->ndirty--;
+	CACHE_STAT(stats.writebacks++);
+	if(flusher(cache->nodes[n].file_num,frameOf(n))!=0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in cache write back of frame %u",cache->nodes[n].file_num);
+		cache->nodes[n].dirty=1;
+		cache->ndirty++;
+		cache->flushFailed=1;
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseFrame
+// Description  : give a node's frame back to the pool, writing it back first
+//                if it is dirty and demoting it to the second tier (a pinned
+//                frame is held until it is unpinned)
+//
+// Inputs       : n - the resident node index
+// Outputs      : none
+
+void releaseFrame(int32_t n)
+{
+	int32_t f=cache->nodes[n].frame;
+
+	if(flushNode(n)==-1)//the frame is going, so is what it failed to write back
+	{
+		cache->nodes[n].dirty=0;
+		cache->ndirty--;
+	}
+	else if(!cache->moving)//evicted clean, the second tier keeps it
+		l2Demote(cache->nodes[n].file_num,frameOf(n));
+
+	if(cache->pins[f].count>0)//still pinned, the pool gets it back on the last unpin
+		cache->pins[f].orphan=1;
+	else
+		cache->freeFrames[cache->nFreeFrames++]=f;
+	cache->nodes[n].frame=CACHE_NIL;
+	cache->cap--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropNode
+// Description  : forget a node entirely, giving back its frame if it had one
+//
+// Inputs       : n - the node index (on a list)
+// Outputs      : none
+
+void dropNode(int32_t n)
+{
+	unlinkNode(n);
+	hashRemove(n);
+
+	if(cache->nodes[n].frame!=CACHE_NIL)
+		releaseFrame(n);
+
+	cache->nodes[n].next=cache->freeNode;
+	cache->freeNode=n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostNode
+// Description  : evict a resident node, keeping it as a ghost on another list
+//
+// Inputs       : n - the resident node index
+//                list - the ghost list to move it to
+// Outputs      : none
+
+void ghostNode(int32_t n, int list)
+{
+	releaseFrame(n);
+
+	unlinkNode(n);
+	pushFront(list,n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : giveFrame
+// Description  : attach a free pool frame to a node, making it resident
+//
+// Inputs       : n - the node index
+// Outputs      : none
+
+void giveFrame(int32_t n)
+{
+	cache->nodes[n].frame=cache->freeFrames[--cache->nFreeFrames];
+	cache->cap++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyFull
+// Description  : check if the policy region holds all the frames it may
+//
+// Inputs       : none
+// Outputs      : 1 if full, 0 if not
+
+int policyFull(void)
+{
+	return(cache->cap-cache->lists[CACHE_WINDOW].size >= cache->pmax);
+}
+
+//
+// TinyLFU admission sketch
+
+// odd multipliers giving each sketch row an independent hash
+const uint32_t sketchSeeds[SKETCH_DEPTH]={ 0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchCounter
+// Description  : locate the 4 bit counter for file_num in one sketch row
+//
+// Inputs       : row - the sketch row
+//                file_num - cart*1024 + frm : flag for each specific frame
+//                shift - set to the bit offset of the counter in its byte
+// Outputs      : pointer to the byte holding the counter
+
+uint8_t* sketchCounter(int row, uint32_t file_num, int *shift)
+{
+	uint32_t idx=((file_num+1)*sketchSeeds[row]) >> (32-cache->sketchBits);
+
+	idx+=(uint32_t)row<<cache->sketchBits;
+	*shift=(idx&1)*4;
+	return(&cache->sketch[idx>>1]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchEstimate
+// Description  : estimated recent reference count of a frame (min over rows)
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the estimate, 0 to SKETCH_MAX_COUNT
+
+int sketchEstimate(uint32_t file_num)
+{
+	int row, shift, c, min=SKETCH_MAX_COUNT;
+	uint8_t *b;
+
+	for(row=0;row<SKETCH_DEPTH;row++)
+	{
+		b=sketchCounter(row,file_num,&shift);
+		c=(*b>>shift)&SKETCH_MAX_COUNT;
+		if(c<min)
+			min=c;
+	}
+	return(min);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchAdd
+// Description  : record a reference to a frame, halving every counter once
+//                a sample period of additions has gone by
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : none
+
+void sketchAdd(uint32_t file_num)
+{
+	int row, shift;
+	uint32_t i, bytes;
+	uint8_t *b;
+
+	if(cache->sketch==NULL)
+		return;
+
+	for(row=0;row<SKETCH_DEPTH;row++)
+	{
+		b=sketchCounter(row,file_num,&shift);
+		if(((*b>>shift)&SKETCH_MAX_COUNT)<SKETCH_MAX_COUNT)
+			*b+=1<<shift;
+	}
+
+	if(++cache->sketchAdds>=cache->sketchSample)//age, old popularity fades
+	{
+		bytes=(SKETCH_DEPTH<<cache->sketchBits)/2;
+		for(i=0;i<bytes;i++)
+			cache->sketch[i]=(cache->sketch[i]>>1)&0x77;
+		cache->sketchAdds/=2;
+	}
+}
+
+//
+// LRU policy
+
+int32_t lruVictim(void)
+{
+	return(cache->lists[LRU_LIST].end);
+}
+
+void lruHit(int32_t n)
+{
+	moveFront(LRU_LIST,n);
+}
+
+void lruTrim(void)
+{
+}
+
+int32_t lruMiss(uint32_t file_num, int32_t n)
+{
+	if(policyFull())//full cache, drop the least recently used
+		dropNode(cache->lists[LRU_LIST].end);
+
+	n=newNode(file_num);
+	giveFrame(n);
+	pushFront(LRU_LIST,n);
+	return(n);
+}
+
+//
+// ARC policy (Megiddo & Modha): T1/T2 resident, B1/B2 ghosts, p adapts
+
+void arcHit(int32_t n)
+{
+	moveFront(ARC_T2,n);
+}
+
+int32_t arcVictim(void)
+{
+	int32_t t1=cache->lists[ARC_T1].size;
+
+	if(t1==cache->pmax)
+		return(cache->lists[ARC_T1].end);
+	if( t1>0 && (t1>cache->p || cache->lists[ARC_T2].size==0) )
+		return(cache->lists[ARC_T1].end);
+	return(cache->lists[ARC_T2].end);
+}
+
+void arcTrim(void)
+{
+	int32_t c=cache->pmax;
+
+	if(cache->p>c)
+		cache->p=c;
+	while(cache->lists[ARC_T1].size+cache->lists[ARC_B1].size>c && cache->lists[ARC_B1].size>0)
+		dropNode(cache->lists[ARC_B1].end);
+	while(cache->lists[ARC_T1].size+cache->lists[ARC_T2].size+cache->lists[ARC_B1].size+cache->lists[ARC_B2].size>2*c
+		&& cache->lists[ARC_B2].size>0)
+		dropNode(cache->lists[ARC_B2].end);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arcReplace
+// Description  : ARC REPLACE, evict from T1 or T2 into the matching ghost list
+//
+// Inputs       : inB2 - 1 if the reference being served was a B2 ghost
+// Outputs      : none
+
+void arcReplace(int inB2)
+{
+	int32_t t1=cache->lists[ARC_T1].size;
+
+	if( t1>0 && (t1>cache->p || (inB2 && t1==cache->p) || cache->lists[ARC_T2].size==0) )
+		ghostNode(cache->lists[ARC_T1].end,ARC_B1);
+	else
+		ghostNode(cache->lists[ARC_T2].end,ARC_B2);
+}
+
+int32_t arcMiss(uint32_t file_num, int32_t n)
+{
+	int32_t c=cache->pmax, delta;
+	int32_t t1=cache->lists[ARC_T1].size, t2=cache->lists[ARC_T2].size;
+	int32_t b1=cache->lists[ARC_B1].size, b2=cache->lists[ARC_B2].size;
+
+	if(n!=CACHE_NIL && cache->nodes[n].list==ARC_B1)// recency ghost hit, grow T1
+	{
+		delta=(b2>b1) ? b2/b1 : 1;
+		cache->p=(cache->p+delta>c) ? c : cache->p+delta;
+		if(policyFull())
+			arcReplace(0);
+	}
+	else if(n!=CACHE_NIL)// frequency ghost hit, shrink T1
+	{
+		delta=(b1>b2) ? b1/b2 : 1;
+		cache->p=(cache->p-delta<0) ? 0 : cache->p-delta;
+		if(policyFull())
+			arcReplace(1);
+	}
+	else
+	{
+		if(t1+b1==c)
+		{
+			if(t1<c)
+			{
+				dropNode(cache->lists[ARC_B1].end);
+				if(policyFull())
+					arcReplace(0);
+			}
+			else
+				dropNode(cache->lists[ARC_T1].end);
+		}
+		else if(t1+t2+b1+b2>=c)
+		{
+			if(t1+t2+b1+b2==2*c)
+				dropNode(cache->lists[ARC_B2].end);
+			if(policyFull())
+				arcReplace(0);
+		}
+
+		n=newNode(file_num);
+		giveFrame(n);
+		pushFront(ARC_T1,n);
+		return(n);
+	}
+
+	giveFrame(n);
+	moveFront(ARC_T2,n);
+	return(n);
+}
+
+//
+// 2Q policy (Johnson & Shasha): A1in FIFO, Am LRU, A1out ghost FIFO
+
+void q2Hit(int32_t n)
+{
+	if(cache->nodes[n].list==Q2_AM)// A1in hits stay put, it is a FIFO
+		moveFront(Q2_AM,n);
+}
+
+int32_t q2Victim(void)
+{
+	int32_t kin=(cache->pmax/4>0) ? cache->pmax/4 : 1;
+
+	if(cache->lists[Q2_A1IN].size>kin || cache->lists[Q2_AM].size==0)
+		return(cache->lists[Q2_A1IN].end);
+	return(cache->lists[Q2_AM].end);
+}
+
+void q2Trim(void)
+{
+	int32_t kout=(cache->pmax/2>0) ? cache->pmax/2 : 1;
+
+	while(cache->lists[Q2_A1OUT].size>kout)
+		dropNode(cache->lists[Q2_A1OUT].end);
+}
+
+int32_t q2Miss(uint32_t file_num, int32_t n)
+{
+	int32_t kout=(cache->pmax/2>0) ? cache->pmax/2 : 1;
+
+	if(policyFull())//reclaim a frame
+	{
+		if(cache->nodes[q2Victim()].list==Q2_A1IN)
+		{
+			ghostNode(cache->lists[Q2_A1IN].end,Q2_A1OUT);
+			if(cache->lists[Q2_A1OUT].size>kout)
+				dropNode(cache->lists[Q2_A1OUT].end);
+		}
+		else
+			dropNode(cache->lists[Q2_AM].end);
+	}
+
+	if(n!=CACHE_NIL && hashFind(file_num)==n)// A1out ghost (still there), promote to Am
+	{
+		giveFrame(n);
+		moveFront(Q2_AM,n);
+		return(n);
+	}
+
+	n=newNode(file_num);
+	giveFrame(n);
+	pushFront(Q2_A1IN,n);
+	return(n);
+}
+
+// the policies selectable by name, the first is the default
+cache_policy policies[]={
+	{ "lru", lruHit, lruMiss, lruVictim, lruTrim },
+	{ "arc", arcHit, arcMiss, arcVictim, arcTrim },
+	{ "2q",  q2Hit,  q2Miss,  q2Victim,  q2Trim  },
+};
+#define CACHE_NUM_POLICIES (sizeof(policies)/sizeof(policies[0]))
+
+cache_policy* policy=&policies[0];
+
+int admission=0; // 1 if the TinyLFU filter guards insertions
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refNode
+// Description  : a resident node was referenced, update its list
+//
+// Inputs       : n - the resident node index
+// Outputs      : none
+
+void refNode(int32_t n)
+{
+	if(cache->nodes[n].list==CACHE_WINDOW)
+		moveFront(CACHE_WINDOW,n);
+	else
+		policy->hit(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : windowMiss
+// Description  : W-TinyLFU insertion, new frames enter the small LRU window
+//                and the frame falling off the window is only let into the
+//                policy region if the sketch says it is more popular than
+//                the frame the policy would evict for it
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the new resident node index
+
+int32_t windowMiss(uint32_t file_num)
+{
+	int32_t cand, old, n;
+	uint32_t fnum;
+	int8_t dirty;
+
+	if(cache->lists[CACHE_WINDOW].size>=cache->wmax)
+	{
+		cand=cache->lists[CACHE_WINDOW].end;
+		fnum=cache->nodes[cand].file_num;
+		old=cache->nodes[cand].frame;
+
+		if( policyFull() && sketchEstimate(fnum)<=sketchEstimate(cache->nodes[policy->victim()].file_num) )
+		{
+			dropNode(cand);//lost to the victim, the candidate goes
+			CACHE_STAT(stats.rejects++);
+		}
+		else
+		{
+			//admitted, the policy evicts if it must and takes the candidate
+			dirty=cache->nodes[cand].dirty;//moving, not evicting, so no write back
+			cache->nodes[cand].dirty=0;
+			cache->moving=1;
+			dropNode(cand);
+			cache->moving=0;
+			n=policy->miss(fnum,CACHE_NIL);
+			if(cache->nodes[n].frame!=old)
+				memcpy(frameOf(n),cache->frames+(size_t)old*CART_FRAME_SIZE,CART_FRAME_SIZE);
+			cache->nodes[n].dirty=dirty;
+		}
+	}
+
+	n=newNode(file_num);
+	giveFrame(n);
+	pushFront(CACHE_WINDOW,n);
+	return(n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_admission
+// Description  : Turn the TinyLFU admission filter on or off (before init)
+//
+// Inputs       : on - 1 to filter insertions, 0 to admit everything
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_admission(int on)
+{
+	if(cache!=NULL && cache->flag==1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache admission, cache already initialized");
+		return(-1);
+	}
+
+	admission=(on!=0);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_writeback
+// Description  : Turn write-back caching on or off (before init)
+//
+// Inputs       : on - 1 to keep writes dirty in the cache, 0 to write through
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_writeback(int on)
+{
+	if(cache!=NULL && cache->flag==1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache writeback, cache already initialized");
+		return(-1);
+	}
+
+	writeback=(on!=0);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_flusher
+// Description  : Register the function the cache writes frames out with
+//
+// Inputs       : flush - writes one frame to the cartridges, 0 on success
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_flusher(int (*flush)(uint32_t file_num, void *frame))
+{
+	flusher=flush;
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fillStats
+// Description  : bring the derived numbers in the stats up to date
+//
+// Inputs       : none
+// Outputs      : none
+
+void fillStats(void)
+{
+	if(cache!=NULL && cache->flag==1)
+	{
+		stats.occupancy=cache->cap;
+		stats.dirty=cache->ndirty;
+	}
+	//every frame that came in and is no longer resident was evicted
+	stats.evictions=stats.insertions-stats.occupancy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countOp
+// Description  : count a get/put, handing out a snapshot every snapshotEvery
+//
+// Inputs       : none
+// Outputs      : none
+
+void countOp(void)
+{
+	if( (++stats.ops%snapshotEvery==0) && (snapshotter!=NULL) )
+	{
+		fillStats();
+		snapshotter(&stats);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache_stats
+// Description  : Copy out the cache counters (still valid after close)
+//
+// Inputs       : out - where to put the counters
+// Outputs      : 0 if successful, -1 if instrumentation is compiled out
+
+int get_cart_cache_stats(CartCacheStats *out)
+{
+#if CART_CACHE_STATS
+	fillStats();
+	*out=stats;
+	return(0);
+#else
+	memset(out,0,sizeof(CartCacheStats));
+	return(-1);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_snapshot
+// Description  : Hand a copy of the counters to a function every few operations
+//
+// Inputs       : every - operations (gets and puts) between snapshots
+//                snap - gets each snapshot, NULL to stop
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_snapshot(uint32_t every, void (*snap)(const CartCacheStats *stats))
+{
+	if(every==0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache snapshot, interval must be > 0");
+		return(-1);
+	}
+
+	snapshotEvery=every;
+	snapshotter=snap;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_policy
+// Description  : Select the replacement policy (must be called before init)
+//
+// Inputs       : name - the policy name, one of lru, arc or 2q
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_policy(const char *name)
+{
+	int i;
+
+	if(cache!=NULL && cache->flag==1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache policy, cache already initialized");
+		return(-1);
+	}
+
+	for(i=0;i<CACHE_NUM_POLICIES;i++)
+		if(strcmp(policies[i].name,name)==0)
+		{
+			policy=&policies[i];
+			return(0);
+		}
+
+	logMessage(LOG_ERROR_LEVEL,"Error in set cache policy, unknown policy [%s]",name);
+	return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_size
+// Description  : Set the size of the cache (must be called before init)
+//
+// Inputs       : max_frames - the maximum number of items your cache can hold
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_size(uint32_t max_frames)
+{
+	if(max_frames==0)
+		return(0);
+
+	if(cache!=NULL && cache->flag==1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache size, cache already initialized");
+		return(-1);
+	}
+
+	if(cache==NULL)
+		cache = (Cache*)(calloc(1,sizeof(Cache)));
+	cache->max=max_frames;
+	cache->flag=0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheLayout
+// Description  : work out the arena layout for a cache of max frames
+//
+// Inputs       : max - the frames in the cache
+//                lay - filled in with the sizes of the arena pieces
+// Outputs      : total bytes of the arena
+
+size_t cacheLayout(int32_t max, cache_layout *lay)
+{
+    //twice the frames in nodes so the policies can remember evicted ghosts
+    lay->nnodes=2*(uint32_t)max;
+
+    //one bucket per node keeps the chains at length ~1 once hashBucket has mixed the keys
+    for(lay->buckets=CACHE_MIN_BUCKETS; lay->buckets<lay->nnodes; lay->buckets<<=1);
+
+    //the admission sketch gets a few counters per frame in each row
+    for(lay->sketchBits=4; (1u<<lay->sketchBits)<SKETCH_WIDTH_FACTOR*(uint32_t)max; lay->sketchBits++);
+    lay->kbytes=(admission) ? (SKETCH_DEPTH<<lay->sketchBits)/2 : 0;
+
+    //spare frames so an evicted frame that is pinned is not reused under the reader
+    lay->nframes=max+CACHE_MAX_PINS;
+
+    //one arena: frames first (page aligned), then nodes, free stack, sync scratch, table, pins and sketch
+    lay->fbytes=(size_t)lay->nframes*CART_FRAME_SIZE;
+    lay->nbytes=(size_t)lay->nnodes*sizeof(cache_node);
+    lay->sbytes=(size_t)lay->nframes*sizeof(int32_t);
+    lay->xbytes=(writeback) ? (size_t)max*sizeof(int32_t) : 0;
+    lay->tbytes=(size_t)lay->buckets*sizeof(int32_t);
+    lay->pbytes=(size_t)lay->nframes*sizeof(cache_pin);
+    lay->pbytes=(lay->pbytes+sizeof(int32_t)-1)&~(sizeof(int32_t)-1);
+
+    return(lay->fbytes+lay->nbytes+lay->sbytes+lay->xbytes+lay->tbytes+lay->pbytes+lay->kbytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheFramesFor
+// Description  : the most frames whose whole arena fits in a byte budget
+//
+// Inputs       : bytes - the memory budget
+// Outputs      : the frames, 0 if not even one fits
+
+int32_t cacheFramesFor(size_t bytes)
+{
+	cache_layout lay;
+	int32_t lo=0, hi, mid;
+
+	hi=(bytes/CART_FRAME_SIZE>CACHE_MAX_FRAMES) ? CACHE_MAX_FRAMES : (int32_t)(bytes/CART_FRAME_SIZE);
+	while(lo<hi)//the arena grows with the frames, binary search the largest fit
+	{
+		mid=lo+(hi-lo+1)/2;
+		if(cacheLayout(mid,&lay)<=bytes)
+			lo=mid;
+		else
+			hi=mid-1;
+	}
+	return(lo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : windowFrames
+// Description  : frames in the admission window for a cache of max frames
+//
+// Inputs       : max - the frames in the cache
+// Outputs      : the window frames, 0 without admission
+
+int32_t windowFrames(int32_t max)
+{
+	if(!admission || max<=1)
+		return(0);
+	return( (max*CACHE_WINDOW_PERCENT/100>0) ? max*CACHE_WINDOW_PERCENT/100 : 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildCache
+// Description  : map an arena for cache->max frames and set up an empty cache
+//                in it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int buildCache(void)
+{
+	cache_layout lay;
+	void *arena;
+	size_t bytes;
+	uint32_t i;
+
+    //mapped on its own so a resize or close hands the memory back to the system
+    bytes=cacheLayout(cache->max,&lay);
+    arena=mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(arena==MAP_FAILED)
+    {
+    	logMessage(LOG_ERROR_LEVEL,"Error in init cache, arena allocation of %lu bytes failed",(unsigned long)bytes);
+        return(-1);
+    }
+    cache->arena=arena;
+    cache->arenaBytes=bytes;
+    cache->nframes=lay.nframes;
+    cache->sketchBits=lay.sketchBits;
+    cache->frames=(char*)cache->arena;
+    cache->nodes=(cache_node*)(cache->frames+lay.fbytes);
+    cache->freeFrames=(int32_t*)((char*)cache->nodes+lay.nbytes);
+    cache->scratch=(int32_t*)((char*)cache->freeFrames+lay.sbytes);
+    cache->table=(int32_t*)((char*)cache->scratch+lay.xbytes);
+
+    for(i=0;i<lay.buckets;i++)
+    	cache->table[i]=CACHE_NIL;
+    for(cache->shift=32;(1u<<(32-cache->shift))<lay.buckets;cache->shift--);
+
+    cache->pins=(cache_pin*)(cache->table+lay.buckets);
+    memset(cache->pins,0,lay.pbytes);
+    cache->npinned=0;
+
+    cache->sketch=NULL;
+    if(admission)
+    {
+    	cache->sketch=(uint8_t*)cache->pins+lay.pbytes;
+    	memset(cache->sketch,0,lay.kbytes);
+    	cache->sketchSample=SKETCH_SAMPLE<<cache->sketchBits;
+    	logMessage(LOG_INFO_LEVEL,"Cache admission sketch uses %lu bytes (%d x %u counters)",
+    		(unsigned long)lay.kbytes,SKETCH_DEPTH,1u<<cache->sketchBits);
+    }
+    cache->sketchAdds=0;
+    cache->ndirty=0;
+    cache->flushFailed=0;
+    cache->rssTick=0;
+
+    //every node on the free chain, every frame on the free stack
+    for(i=0;i<lay.nnodes;i++)
+    	cache->nodes[i].next=(i+1<lay.nnodes) ? (int32_t)i+1 : CACHE_NIL;
+    cache->freeNode=0;
+    for(i=0;i<(uint32_t)cache->nframes;i++)
+    	cache->freeFrames[i]=cache->nframes-1-i;
+    cache->nFreeFrames=cache->nframes;
+
+    for(i=0;i<CACHE_MAX_LISTS;i++)
+    {
+    	cache->lists[i].start=cache->lists[i].end=CACHE_NIL; //no values, start and end both null
+    	cache->lists[i].size=0;
+    }
+
+    //admission keeps a small window in front of the policy
+    cache->wmax=windowFrames(cache->max);
+    cache->pmax=cache->max-cache->wmax;
+
+    cache->cap=0;
+    cache->p=0;
+
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_cart_cache
+// Description  : Initialize the cache and note maximum frames
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int init_cart_cache(void)
+{
+	if(cache==NULL)
+	{
+
+		set_cart_cache_size(DEFAULT_CART_FRAME_CACHE_SIZE);	//sets to default if not -c flag in cmd line call
+
+
+			if(cache==NULL)
+				return(0);
+	}
+
+    if( cache->flag==0)
+	 	cache->flag=1; 
+    else
+    {
+    	logMessage(LOG_ERROR_LEVEL,"Error in init cache flag is already on");
+        return(-1);
+    }
+
+    if(buildCache()!=0)
+    {
+    	cache->arena=NULL;
+    	cache->flag=0;
+        return(-1);
+    }
+    cache->moving=0;
+    if(l2Open()!=0)
+    {
+    	l2Close();
+    	munmap(cache->arena,cache->arenaBytes);
+    	cache->arena=NULL;
+    	cache->flag=0;
+        return(-1);
+    }
+
+    memset(&stats,0,sizeof(stats));
+    stats.max_frames=cache->max;
+
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuildCache
+// Description  : move a running cache into an arena for max frames, evicting
+//                in policy order first when it shrinks
+//
+// Inputs       : max - the new number of frames
+// Outputs      : 0 if successful, -1 if failure
+
+int rebuildCache(int32_t max)
+{
+	Cache old;
+	int32_t l, n, m, pmax, wmax=windowFrames(max);
+
+	//shrinking, evict through the old structures in the order the policy would
+	cache->flushFailed=0;
+	while(cache->lists[CACHE_WINDOW].size>wmax)
+		dropNode(cache->lists[CACHE_WINDOW].end);
+	while(cache->cap-cache->lists[CACHE_WINDOW].size>max-wmax)
+		dropNode(policy->victim());
+
+	//trim the ghosts so they fit the smaller node array
+	pmax=cache->pmax;
+	cache->pmax=max-wmax;
+	policy->trim();
+	cache->pmax=pmax;
+
+	old=*cache;
+	cache->max=max;
+	if(buildCache()!=0)
+	{
+		*cache=old;//the old arena is untouched, keep running in it
+		return(-1);
+	}
+
+	//oldest first on every list, so pushing each to the front keeps the order
+	for(l=0;l<CACHE_MAX_LISTS;l++)
+		for(n=old.lists[l].end;n!=CACHE_NIL;n=old.nodes[n].prev)
+		{
+			m=newNode(old.nodes[n].file_num);
+			if(old.nodes[n].frame!=CACHE_NIL)
+			{
+				giveFrame(m);
+				memcpy(frameOf(m),old.frames+(size_t)old.nodes[n].frame*CART_FRAME_SIZE,CART_FRAME_SIZE);
+				cache->nodes[m].dirty=old.nodes[n].dirty;
+				cache->ndirty+=old.nodes[n].dirty;
+			}
+			pushFront(l,m);
+		}
+
+	//the adaptive state carries over, the sketch too if its width did not change
+	cache->p=(old.p>cache->pmax) ? cache->pmax : old.p;
+	if(cache->sketch!=NULL && old.sketch!=NULL && cache->sketchBits==old.sketchBits)
+	{
+		memcpy(cache->sketch,old.sketch,(SKETCH_DEPTH<<cache->sketchBits)/2);
+		cache->sketchAdds=old.sketchAdds;
+	}
+	cache->flushFailed=old.flushFailed;
+	munmap(old.arena,old.arenaBytes);
+
+	stats.max_frames=cache->max;
+
+	return( (cache->flushFailed) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resize_cart_cache
+// Description  : Set the cache memory budget in bytes, resizing a running
+//                cache in place (the budget covers the whole arena)
+//
+// Inputs       : bytes - the memory the cache may use
+// Outputs      : 0 if successful, -1 if failure
+
+int resize_cart_cache(size_t bytes)
+{
+	int32_t max=cacheFramesFor(bytes);
+
+	if(max==0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in resize cache, %lu bytes will not hold a frame",(unsigned long)bytes);
+		return(-1);
+	}
+
+	if(cache==NULL || cache->flag!=1)//not running yet, just the size
+		return(set_cart_cache_size(max));
+
+	if(cache->npinned>0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in resize cache, %d frames are pinned",cache->npinned);
+		return(-1);
+	}
+
+	if(max==cache->max)
+		return(0);
+
+	logMessage(LOG_INFO_LEVEL,"Cache resized from %d to %d frames (%lu bytes)",cache->max,max,(unsigned long)bytes);
+	return(rebuildCache(max));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_l2
+// Description  : Put a second tier in a mapped local file under the cache,
+//                evicted clean frames go there (must be called before init)
+//
+// Inputs       : path - the file to create, NULL for no second tier
+//                frames - frames the file holds
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_l2(const char *path, uint32_t frames)
+{
+	if(cache!=NULL && cache->flag==1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in set cache second tier, cache already initialized");
+		return(-1);
+	}
+
+	free(l2Path);
+	l2Path=NULL;
+	l2Frames=0;
+	if(path!=NULL && frames>0)
+	{
+		l2Path=strdup(path);
+		l2Frames=frames;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_memory_limit
+// Description  : Shrink the cache when the process memory (RSS) goes over a
+//                ceiling, checked every CACHE_RSS_CHECK operations
+//
+// Inputs       : bytes - the ceiling, 0 to turn the controller off
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_memory_limit(size_t bytes)
+{
+	rssLimit=bytes;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : processRss
+// Description  : the resident memory of this process
+//
+// Inputs       : none
+// Outputs      : bytes resident, 0 if it cannot be read
+
+size_t processRss(void)
+{
+	FILE *f=fopen("/proc/self/statm","r");
+	unsigned long size, resident=0;
+
+	if(f==NULL)
+		return(0);
+	if(fscanf(f,"%lu %lu",&size,&resident)!=2)
+		resident=0;
+	fclose(f);
+
+	return( (size_t)resident*(size_t)sysconf(_SC_PAGESIZE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : memoryCheck
+// Description  : RSS controller, every CACHE_RSS_CHECK operations shrink the
+//                cache by what the process is over the limit (plus slack)
+//
+// Inputs       : none
+// Outputs      : none
+
+void memoryCheck(void)
+{
+	size_t rss, excess, slack;
+	int32_t max;
+
+	if(rssLimit==0 || ++cache->rssTick<CACHE_RSS_CHECK || cache->npinned>0)
+		return;
+	cache->rssTick=0;
+
+	rss=processRss();
+	if(rss<=rssLimit)
+		return;
+
+	//give back the overshoot and a bit more so it does not trip again at once
+	excess=rss-rssLimit;
+	slack=cache->arenaBytes/CACHE_RSS_SLACK;
+	max=(cache->arenaBytes>excess+slack) ? cacheFramesFor(cache->arenaBytes-excess-slack) : 0;
+	if(max<CACHE_MIN_FRAMES)
+		max=CACHE_MIN_FRAMES;
+	if(max>=cache->max)
+		return;
+
+	logMessage(LOG_INFO_LEVEL,"Cache over the memory limit (rss %lu > %lu), shrinking from %d to %d frames",
+		(unsigned long)rss,(unsigned long)rssLimit,cache->max,max);
+	rebuildCache(max);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_cart_cache
+// Description  : Clear all of the contents of the cache, cleanup
+//
+// Inputs       : none
+// Outputs      : o if successful, -1 if failure
+
+int close_cart_cache(void)
+{
+	if(cache==NULL)
+		return(0);
+
+	//nothing dirty may be lost with the arena
+	if(sync_cart_cache()!=0)
+		logMessage(LOG_ERROR_LEVEL,"Error in close cache, write back failed");
+	CACHE_STAT(fillStats());//freeze the final numbers for get_cart_cache_stats
+
+    if( cache->flag==1)
+	 	cache->flag=0; 
+    else
+    {
+    	logMessage(LOG_ERROR_LEVEL,"Error in close cache flag is already off");
+        return(-1);
+    }
+
+	CACHE_STAT(logMessage(LOG_INFO_LEVEL,"Cache [%s] closed, %llu hits, %llu misses, %llu rejected, %llu written back",
+		policy->name,(unsigned long long)stats.hits,(unsigned long long)stats.misses,
+		(unsigned long long)stats.rejects,(unsigned long long)stats.writebacks));
+
+	munmap(cache->arena,cache->arenaBytes);//frames, nodes and table all live in the arena
+	l2Close();
+	cache->arena=NULL;
+	cache->frames=NULL;
+	cache->nodes=NULL;
+	cache->freeFrames=NULL;
+	cache->table=NULL;
+	cache->pins=NULL;
+	cache->sketch=NULL;
+    free(cache);
+    cache=NULL;
+
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insertFrame
+// Description  : make file_num resident with the contents of buf
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+//                buf - the buffer to insert into the cache
+// Outputs      : the resident node index
+
+int32_t insertFrame(uint32_t file_num, void *buf)
+{
+	int32_t n, l;
+
+	memoryCheck();//before any node is looked up, a shrink moves them all
+	n=hashFind(file_num);
+
+	if(n!=CACHE_NIL && cache->nodes[n].frame!=CACHE_NIL)// already in the cache, overwrite
+	{
+		refNode(n);
+		CACHE_STAT(stats.overwrites++);
+	}
+	else
+	{
+		if((l=l2Find(file_num))!=CACHE_NIL)//the second tier copy is superseded
+			l2Remove(l);
+
+		if(n==CACHE_NIL && cache->wmax>0)// never seen, goes through the admission window
+			n=windowMiss(file_num);
+		else	//not resident, the policy makes room and hands back a node with a frame
+			n=policy->miss(file_num,n);
+
+		CACHE_STAT(stats.insertions++; if(cache->cap>(int32_t)stats.peak) stats.peak=cache->cap);
+	}
+	CACHE_STAT(countOp());
+
+	memcpy(frameOf(n),buf,CART_FRAME_SIZE);//over right the buffer
+
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_cart_cache
+// Description  : Put an object into the frame cache
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+//                buf - the buffer to insert into the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int put_cart_cache(uint32_t file_num, void *buf)  
+{
+	if(cache==NULL || cache->flag!=1)
+		return(0);
+
+	cache->flushFailed=0;
+	insertFrame(file_num,buf);
+
+	return( (cache->flushFailed) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_cart_cache
+// Description  : Write a frame through the cache, in write-back mode it stays
+//                dirty in the cache, otherwise it goes to the cartridges now
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+//                buf - the frame to write
+// Outputs      : 0 if successful, -1 if failure
+
+int write_cart_cache(uint32_t file_num, void *buf)
+{
+	int32_t n;
+
+	if(cache==NULL || cache->flag!=1 || !writeback)//write through
+	{
+		if(flusher(file_num,buf)!=0)
+			return(-1);
+		return(put_cart_cache(file_num,buf));
+	}
+
+	cache->flushFailed=0;
+	n=insertFrame(file_num,buf);
+	if(!cache->nodes[n].dirty)
+	{
+		cache->nodes[n].dirty=1;
+		cache->ndirty++;
+	}
+
+	return( (cache->flushFailed) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dirtyOrder
+// Description  : qsort comparison putting dirty nodes in cart, then frame order
+//
+// Inputs       : a, b - pointers to the node indices
+// Outputs      : <0, 0, >0 as a sorts before, with, after b
+
+int dirtyOrder(const void *a, const void *b)
+{
+	uint32_t fa=cache->nodes[*(const int32_t*)a].file_num;
+	uint32_t fb=cache->nodes[*(const int32_t*)b].file_num;
+
+	return( (fa>fb) - (fa<fb) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sync_cart_cache
+// Description  : Write every dirty frame back, grouped by cartridge so each
+//                cartridge is loaded once
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sync_cart_cache(void)
+{
+	int32_t i, l, n, count=0;
+
+	if(cache==NULL || cache->flag!=1 || cache->ndirty==0)
+		return(0);
+
+	//gather the dirty frames from every list and sort them by file_num
+	for(l=0;l<CACHE_MAX_LISTS;l++)
+		for(n=cache->lists[l].start;n!=CACHE_NIL;n=cache->nodes[n].next)
+			if(cache->nodes[n].dirty)
+				cache->scratch[count++]=n;
+	qsort(cache->scratch,count,sizeof(int32_t),dirtyOrder);
+
+	cache->flushFailed=0;
+	for(i=0;i<count;i++)
+		flushNode(cache->scratch[i]);
+
+	return( (cache->flushFailed) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_cart_cache
+// Description  : write one frame back if it is resident and dirty
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_cart_cache(uint32_t file_num)
+{
+	int32_t n;
+
+	if(cache==NULL || cache->flag!=1 || cache->ndirty==0)
+		return(0);
+
+	n=hashFind(file_num);
+	if(n==CACHE_NIL || cache->nodes[n].frame==CACHE_NIL)
+		return(0);
+	return(flushNode(n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupNode
+// Description  : count a reference to a frame and find it if it is resident,
+//                promoting it from the second tier if it is there
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : the resident node index or CACHE_NIL if not found
+
+int32_t lookupNode(uint32_t file_num)
+{
+	int32_t n=hashFind(file_num), l;
+	char buf[CART_FRAME_SIZE];
+
+	sketchAdd(file_num);
+
+	if(n==CACHE_NIL || cache->nodes[n].frame==CACHE_NIL)//not in the cache (or only a ghost)
+	{
+		if((l=l2Find(file_num))==CACHE_NIL)
+		{
+			CACHE_STAT(stats.misses++;countOp());
+			return(CACHE_NIL);
+		}
+
+		//second tier hit, promote it (copied out first, the insert may demote into its slot)
+		memcpy(buf,cache->l2.map+(size_t)l*CART_FRAME_SIZE,CART_FRAME_SIZE);
+		l2Remove(l);
+		CACHE_STAT(stats.hits++;stats.l2hits++);
+		return(insertFrame(file_num,buf));
+	}
+
+	CACHE_STAT(stats.hits++;countOp());
+	refNode(n);
+
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache
+// Description  : Get an frame from the cache (and return it)
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : pointer to cached frame or NULL if not found
+
+void * get_cart_cache( uint32_t file_num)
+{
+	int32_t n;
+
+	if(cache==NULL || cache->flag!=1)
+		return(NULL);
+
+	memoryCheck();
+	n=lookupNode(file_num);
+
+	return( (n==CACHE_NIL) ? NULL : frameOf(n) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache_room
+// Description  : Get the number of new frames the cache takes in before the
+//                first of them may be pushed out (the admission window when
+//                there is one, otherwise the whole cache)
+//
+// Inputs       : none
+// Outputs      : the frames, 0 if the cache is not running
+
+uint32_t get_cart_cache_room(void)
+{
+	if(cache==NULL || cache->flag!=1)
+		return(0);
+	return( (cache->wmax>0) ? cache->wmax : cache->max );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probe_cart_cache
+// Description  : Check if a frame is in the cache (or its second tier),
+//                without counting it as a reference
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : 1 if it is, 0 if not
+
+int probe_cart_cache(uint32_t file_num)
+{
+	int32_t n;
+
+	if(cache==NULL || cache->flag!=1)
+		return(0);
+
+	n=hashFind(file_num);
+	if(n!=CACHE_NIL && cache->nodes[n].frame!=CACHE_NIL)
+		return(1);
+	return( l2Find(file_num)!=CACHE_NIL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pin_cart_cache
+// Description  : Get a frame from the cache and pin it, the pointer stays
+//                valid (eviction will not reuse the memory) until unpinned
+//
+// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
+// Outputs      : pointer to the pinned frame or NULL if not found (or if
+//                CACHE_MAX_PINS frames are already pinned)
+
+void * pin_cart_cache(uint32_t file_num)
+{
+	int32_t n, f;
 
- }Cache;
+	if(cache==NULL || cache->flag!=1)
+		return(NULL);
 
- // initialize the cache globally since i cant pass the pointer around
-Cache* cache=NULL;
+	//a new pin needs a spare frame to cover it
+	memoryCheck();
+	n=hashFind(file_num);
+	if( cache->npinned>=CACHE_MAX_PINS && (n==CACHE_NIL || cache->nodes[n].frame==CACHE_NIL ||
+		cache->pins[cache->nodes[n].frame].count==0) )
+		return(NULL);
 
+	if((n=lookupNode(file_num))==CACHE_NIL)
+		return(NULL);
 
+	f=cache->nodes[n].frame;
+	if(cache->pins[f].count++==0)
+		cache->npinned++;
 
-cache_node* newNode(uint32_t file_num, void* buf)
-{
-	cache_node* node = (cache_node*)calloc(1,sizeof(cache_node));
-	node->file_num=file_num;
-	if(buf!=NULL)
-		memcpy(node->frame,buf,1024);
-	 
-	 node->prev=node->next=NULL; // set to null initially, to be changed after called
-	return node;
+	return(frameOf(n));
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : set_cart_cache_size
-// Description  : Set the size of the cache (must be called before init)
+// Function     : unpin_cart_cache
+// Description  : Release a pin, returning the frame to the pool if it was
+//                evicted while pinned
 //
-// Inputs       : max_frames - the maximum number of items your cache can hold
+// Inputs       : frame - pointer returned by pin_cart_cache
 // Outputs      : 0 if successful, -1 if failure
 
-int set_cart_cache_size(uint32_t max_frames)
+int unpin_cart_cache(void *frame)
 {
-	if(max_frames<0)
+	int32_t f;
+
+	if(cache==NULL || cache->flag!=1)
 		return(-1);
-	if(max_frames==0)
-		return(0);
 
-	cache = (Cache*)(malloc(sizeof(Cache)));
-	cache->max=max_frames;
-	cache->flag=0;
+	f=(int32_t)(((char*)frame-cache->frames)/CART_FRAME_SIZE);
+	if((char*)frame<cache->frames || f>=cache->nframes || cache->pins[f].count==0)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error in unpin cache, frame is not pinned");
+		return(-1);
+	}
+
+	if(--cache->pins[f].count==0)
+	{
+		cache->npinned--;
+		if(cache->pins[f].orphan)
+		{
+			cache->pins[f].orphan=0;
+			cache->freeFrames[cache->nFreeFrames++]=f;
+		}
+	}
+
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : init_cart_cache
-// Description  : Initialize the cache and note maximum frames
+// Function     : delete_cart_cache
+// Description  : Remove a frame from the cache and the second tier, for a
+//                frame given back to the carts. A dirty frame is dropped
+//                without a write back, its file is gone
 //
-// Inputs       : none
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : cart - the cart number of the frame to remove from cache
+//                blk - the frame number of the frame to remove from cache
+// Outputs      : NULL, the frame goes back to the pool
 
-int init_cart_cache(void)
-{
-	if(cache==NULL)
-	{	
-	
-		set_cart_cache_size(DEFAULT_CART_FRAME_CACHE_SIZE);	//sets to default if not -c flag in cmd line call
-			
+void * delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk) {
+	uint32_t file_num=cart*1024+blk;
+	int32_t n;
 
-			if(cache==NULL)
-				return(0);
+	if(cache==NULL || cache->flag!=1)
+		return(NULL);
+
+	if((n=l2Find(file_num))!=CACHE_NIL)
+		l2Remove(n);
+
+	n=hashFind(file_num);
+	if(n==CACHE_NIL)
+		return(NULL);
+
+	if(cache->nodes[n].dirty)
+	{
+		cache->nodes[n].dirty=0;
+		cache->ndirty--;
 	}
+	cache->moving=1;//no demote to the second tier either
+	dropNode(n);
+	cache->moving=0;
+	return(NULL);
+}
 
-    if( cache->flag==0)
-	 	cache->flag=1; 
-    else
-    {
-    	logMessage(LOG_ERROR_LEVEL,"Error in init cache flag is already on");
-        return(-1);
-    }
+//
+// Unit test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheModelTest
+// Description  : Randomly get/put frames, checking contents and occupancy,
+//                and against a reference LRU model when the policy is lru
+//
+// Inputs       : none (uses the current policy)
+// Outputs      : 0 if successful, -1 if failure
+
+int cacheModelTest(void) {
+
+	// Local variables
+	uint32_t stamp[CACHE_TEST_FRAMES], ver[CACHE_TEST_FRAMES];
+	uint32_t clock=0, used=0, fnum, victim, i, op;
+	int lru=( (policy==&policies[0]) && !admission );
+	char buf[1024], *frm;
+
+	memset(stamp,0,sizeof(stamp));
+	memset(ver,0,sizeof(ver));
+
+	for (op=0; op<CACHE_TEST_OPS; op++) {
+		fnum=getRandomValue(0, CACHE_TEST_FRAMES-1);
+		clock++;
 
-    cache->start=cache->end=NULL; //no values, creates start pointing to end and both null
+		if (getRandomValue(0, 1)) {
 
+			// Put a new version of the frame, evict the oldest in the model
+			if ( (stamp[fnum]==0) && (used==CACHE_TEST_SIZE) ) {
+				victim=fnum;
+				for (i=0; i<CACHE_TEST_FRAMES; i++) {
+					if ( (stamp[i]!=0) && ((victim==fnum) || (stamp[i]<stamp[victim])) ) {
+						victim=i;
+					}
+				}
+				stamp[victim]=0;
+				used--;
+			}
+			if (stamp[fnum]==0) {
+				used++;
+			}
+			ver[fnum]++;
+			stamp[fnum]=clock;
+			memset(buf, (char)(fnum+ver[fnum]), 1024);
+			if (put_cart_cache(fnum, buf)) {
+				logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed on put [%u].", policy->name, fnum);
+				return(-1);
+			}
+
+		} else {
+
+			// Get the frame, under lru must be present exactly when the model has it
+			frm=get_cart_cache(fnum);
+			if ( lru && ((frm!=NULL) != (stamp[fnum]!=0)) ) {
+				logMessage(LOG_ERROR_LEVEL, "Cache unit test failed, frame %u %s.", fnum,
+					(frm==NULL) ? "missing" : "not evicted");
+				return(-1);
+			}
+			if (frm!=NULL) {
+				memset(buf, (char)(fnum+ver[fnum]), 1024);
+				if (memcmp(frm, buf, 1024)!=0) {
+					logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frame %u bad contents.",
+						policy->name, fnum);
+					return(-1);
+				}
+				stamp[fnum]=clock;
+			}
+		}
 
-    cache->cap=-1;
+		if (cache->cap>cache->max) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, %d frames resident.",
+				policy->name, cache->cap);
+			return(-1);
+		}
+	}
 
+	// Return successfully
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : close_cart_cache
-// Description  : Clear all of the contents of the cache, cleanup
+// Function     : cacheScanTest
+// Description  : Check a hot set referenced twice survives a long one-time scan
 //
-// Inputs       : none
-// Outputs      : o if successful, -1 if failure
+// Inputs       : none (uses the current policy)
+// Outputs      : number of hot frames still resident after the scan
 
-int close_cart_cache(void)
-{
-	if(cache==NULL)
-		return(0);
+int cacheScanTest(void) {
 
-	cache_node* next= cache->start;
-	cache_node* curr;
-	int i;
+	// Local variables
+	char buf[1024];
+	int i, survivors=0;
 
-    if( cache->flag==1)
-	 	cache->flag=0; 
-    else
-    {
-    	logMessage(LOG_ERROR_LEVEL,"Error in close cache flag is already off");
-        return(-1);
-    }
-	
-	for(i=1;i<cache->max && i<cache->cap;i++)
-	{	curr=next; //sets pointer curr too the next node in the series
-		if(next!=cache->end)
-			next=curr->next; // saves the next node
-		else
-			i=cache->max;// ensures exit of the for loop
-				
-		curr->next=curr->prev=NULL;//sets the pointers to null
-		
-		free(curr); // frees the allocated memory
-		
-	}//alll allocated nodes are deallocated
-
-	cache->start=cache->end=NULL;
-    free(cache);
-    cache=NULL;
+	memset(buf, 0x5a, 1024);
 
-	return(0);
+	// Reference the hot set, push it out with filler, then reference it twice
+	for (i=0; i<CACHE_TEST_HOT; i++) {
+		put_cart_cache(i, buf);
+	}
+	for (i=0; i<CACHE_TEST_SIZE; i++) {
+		put_cart_cache(CACHE_TEST_FRAMES+i, buf);
+	}
+	for (i=0; i<CACHE_TEST_HOT; i++) {
+		put_cart_cache(i, buf);
+		get_cart_cache(i);
+	}
+
+	// Now scan a long run of frames that are never used again
+	for (i=0; i<CACHE_TEST_SCAN; i++) {
+		put_cart_cache(2*CACHE_TEST_FRAMES+i, buf);
+	}
+
+	for (i=0; i<CACHE_TEST_HOT; i++) {
+		if (get_cart_cache(i)!=NULL) {
+			survivors++;
+		}
+	}
+	return(survivors);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : put_cart_cache
-// Description  : Put an object into the frame cache
+// Function     : cacheAdmissionTest
+// Description  : Check a hot set keeps its frames while one-hit frames stream
+//                past, reading through the cache the way the driver does
 //
-// Inputs       : file_num - cart*1024 + frm : flag for each specific frame
-//                buf - the buffer to insert into the cache
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : none (uses the current policy and admission setting)
+// Outputs      : number of hot frames still resident after the stream
 
-int put_cart_cache(uint32_t file_num, void *buf)  
-{	
-	if(cache==NULL)
-		return(0);
+int cacheAdmissionTest(void) {
 
-	cache_node* node;
-	int i;
-	int x;
-	if(cache->cap==-1)//cache is empty
-	{	
-		node= newNode(file_num,buf);
-		node->prev = NULL;
-		node->next = NULL;
-		cache->start = node;
-		cache->end = node;
-		cache->cap=1;
-		return(0);
+	// Local variables
+	char buf[1024];
+	int i, r, survivors=0;
+
+	memset(buf, 0x3c, 1024);
+
+	// Warm up the hot set, then stream frames with an occasional hot reference
+	for (r=0; r<CACHE_TEST_REFS; r++) {
+		for (i=0; i<CACHE_TEST_HOT; i++) {
+			if (get_cart_cache(i)==NULL) {
+				put_cart_cache(i, buf);
+			}
+		}
 	}
-	node=cache->start; //needed for the next 2 scenarios
-	
-	if(cache->cap<cache->max)
-		x=cache->cap;
-	else
-		x=cache->max;
+	for (i=0; i<CACHE_TEST_SCAN; i++) {
+		if (get_cart_cache(CACHE_TEST_FRAMES+i)==NULL) {
+			put_cart_cache(CACHE_TEST_FRAMES+i, buf);
+		}
+		if ( (i%CACHE_TEST_STRIDE==0) && (get_cart_cache((i/CACHE_TEST_STRIDE)%CACHE_TEST_HOT)==NULL) ) {
+			put_cart_cache((i/CACHE_TEST_STRIDE)%CACHE_TEST_HOT, buf);
+		}
+	}
+
+	for (i=0; i<CACHE_TEST_HOT; i++) {
+		if (get_cart_cache(i)!=NULL) {
+			survivors++;
+		}
+	}
+	return(survivors);
+}
 
-		for(i=0;i<x;i++)
-		{	if(node -> file_num == file_num)// check if already in the cache
-			{	
+// unit test stand-in for the cartridges behind the write-back cache
+char *cacheTestDisk=NULL;
+uint32_t cacheTestWrites=0, cacheTestLast=0;
+int cacheTestSorted=1, cacheTestFail=0;
 
-				memcpy(node->frame,buf,1024);//copy the buffer to the node frame
+int cacheTestFlush(uint32_t file_num, void *frame) {
+	if (cacheTestFail) {
+		return(-1);
+	}
+	if (file_num<cacheTestLast) {
+		cacheTestSorted=0;
+	}
+	cacheTestLast=file_num;
+	cacheTestWrites++;
+	memcpy(&cacheTestDisk[file_num*CART_FRAME_SIZE], frame, CART_FRAME_SIZE);
+	return(0);
+}
 
-				if(node==cache->start)// if at start dont do anything
-					return(0);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheWritebackTest
+// Description  : Rewrite frames through a write-back cache, check the disk
+//                ends up with every last version and far fewer writes
+//
+// Inputs       : none (uses the current policy)
+// Outputs      : 0 if successful, -1 if failure
 
-				if(node==cache->end)// if at end update the new end
-				{
-					node -> prev -> next = NULL;
-					cache->end=node->prev;
-				}
-				else	//node in the middle...update the prev to next and vise versa
-				{
-					node->next->prev= node->prev;
-					node->prev->next=node->next;
-				}
+int cacheWritebackTest(void) {
+
+	// Local variables
+	uint32_t ver[CACHE_TEST_FRAMES], fnum, op;
+	char buf[1024];
+	int ret=0;
+
+	cacheTestDisk=calloc(CACHE_TEST_FRAMES, CART_FRAME_SIZE);
+	memset(ver, 0, sizeof(ver));
+	cacheTestWrites=0;
+	set_cart_cache_flusher(cacheTestFlush);
+	writeback=1;
+	cache=NULL;
+	set_cart_cache_size(CACHE_TEST_SIZE);
+	init_cart_cache();
+
+	// Small rewrites clustered on a few frames at a time, like appends
+	for (op=0; op<CACHE_TEST_OPS/10; op++) {
+		fnum=(op/32)%CACHE_TEST_FRAMES;
+		if (getRandomValue(0, 3)==0) {
+			fnum=getRandomValue(0, CACHE_TEST_FRAMES-1);
+		}
+		ver[fnum]++;
+		memset(buf, (char)(fnum+ver[fnum]), 1024);
+		if (write_cart_cache(fnum, buf)) {
+			ret=-1;
+		}
+	}
 
-				//set node to the start of the list
-				node->prev=NULL; // curr node==start == no previous node
-				
-				node->next=cache->start; // curr node next is set to the start
-				
-				cache->start->prev= node;// update start->prev to node
-				
-				cache->start=node;//start is set to curr node with prev=null and next = old start
-				
-				return(0); //end if same file_num
-			}
+	// A failed write back leaves the frame dirty for the sync to retry
+	op=cache->ndirty;
+	cacheTestFail=1;
+	if ( (flush_cart_cache(fnum)!=-1) || (cache->ndirty!=op) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frame %u clean after a failed write back.", policy->name, fnum);
+		ret=-1;
+	}
+	cacheTestFail=0;
+
+	// The sync must go in order, after it the disk has every frame
+	cacheTestLast=0;
+	cacheTestSorted=1;
+	sync_cart_cache();
+	if (!cacheTestSorted) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, sync out of order.", policy->name);
+		ret=-1;
+	}
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		memset(buf, (char)(fnum+ver[fnum]), 1024);
+		if ( (ver[fnum]!=0) && (memcmp(&cacheTestDisk[fnum*CART_FRAME_SIZE], buf, 1024)!=0) ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frame %u lost write.", policy->name, fnum);
+			ret=-1;
+			break;
+		}
+	}
+	logMessage(LOG_INFO_LEVEL, "Cache unit test [%s], %u writes became %u write backs.",
+		policy->name, CACHE_TEST_OPS/10, cacheTestWrites);
+
+	close_cart_cache();
+	writeback=0;
+	free(cacheTestDisk);
+	cacheTestDisk=NULL;
+	return(ret);
+}
 
-			if(node->next!=NULL)//should never happen but just in case
-				
-				node=node->next;//go to next node
-			
-			else
-			
-				i=x; //force exit loop.... should never happen
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cachePinTest
+// Description  : Pin frames, push them out with a stream of new frames and
+//                check the pinned memory is untouched and returned on unpin
+//
+// Inputs       : none (uses the current cache)
+// Outputs      : 0 if successful, -1 if failure
 
+int cachePinTest(void) {
+
+	// Local variables
+	char buf[1024], *pinned[CACHE_MAX_PINS];
+	uint32_t fnum;
+	int ret=0, i;
+
+	// Pin as many frames as allowed, one more must be refused
+	for (i=0; i<=CACHE_MAX_PINS; i++) {
+		memset(buf, (char)i, 1024);
+		put_cart_cache(i, buf);
+		if (i<CACHE_MAX_PINS) {
+			pinned[i]=pin_cart_cache(i);
+			if ( (pinned[i]==NULL) || (pin_cart_cache(i)!=pinned[i]) || unpin_cart_cache(pinned[i]) ) {
+				logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, pin of frame %d.", policy->name, i);
+				return(-1);
+			}
+		} else if (pin_cart_cache(i)!=NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, pin limit not enforced.", policy->name);
+			ret=-1;
+		}
+	}
 
-		}//end for loop
+	// Stream new frames through, the pinned memory must not be reused
+	for (fnum=CACHE_MAX_PINS+1; fnum<CACHE_TEST_FRAMES; fnum++) {
+		memset(buf, 0xff, 1024);
+		put_cart_cache(fnum, buf);
+	}
+	for (i=0; i<CACHE_MAX_PINS; i++) {
+		memset(buf, (char)i, 1024);
+		if (memcmp(pinned[i], buf, 1024)!=0) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, pinned frame %d reused.", policy->name, i);
+			ret=-1;
+		}
+		unpin_cart_cache(pinned[i]);
+	}
 
+	// Every frame is back, resident or free
+	if (cache->cap+cache->nFreeFrames!=cache->nframes) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, unpin leaked frames.", policy->name);
+		ret=-1;
+	}
+	return(ret);
+}
 
-		if(x==cache->cap)// if reaches this point create a new node
-		{
-			node= newNode(file_num,buf);
-			
-			node->next = cache->start;
-			
-			node->prev=NULL;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheResidentCheck
+// Description  : check every resident frame of the first "frames" holds the
+//                pattern it was put with (each byte is the frame number)
+//
+// Inputs       : frames - the frame numbers to look at
+// Outputs      : number of resident frames, -1 if one is corrupt
 
-			cache->start->prev=node;
+int cacheResidentCheck(uint32_t frames) {
 
-			cache->start = node;
+	// Local variables
+	char buf[1024];
+	int32_t n;
+	uint32_t fnum;
+	int resident=0;
 
-			cache->cap= (cache->cap) + 1;
-			
-			return(0);
+	for (fnum=0; fnum<frames; fnum++) {
+		n=hashFind(fnum);
+		if ( (n==CACHE_NIL) || (cache->nodes[n].frame==CACHE_NIL) ) {
+			continue;
+		}
+		memset(buf, (char)fnum, 1024);
+		if (memcmp(frameOf(n), buf, 1024)!=0) {
+			return(-1);
 		}
+		resident++;
+	}
+	return(resident);
+}
 
-	//past here we have a full cache and need to replace		
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheResizeTest
+// Description  : Shrink and grow a running cache, check the frames kept are
+//                intact, the budget holds and (lru) the oldest frames went
+//
+// Inputs       : none (uses the current cache)
+// Outputs      : 0 if successful, -1 if failure
 
-	//set the new cache end
-	node=cache->end;
-	
-	cache->end=node->prev;
-	
-	cache->end->next=NULL;
+int cacheResizeTest(void) {
 
+	// Local variables
+	cache_layout lay;
+	char buf[1024], *pinned;
+	uint32_t fnum;
+	int resident;
 
-	//overwrite the curr node with the new information
-	node->file_num=file_num;//over right the file num
-	
-	memcpy(node->frame,buf,1024);//over right the buffer
-	
-	node -> prev = NULL;
-	
-	node -> next = cache -> start;
+	// Fill the cache, then touch the first half so the second half is oldest
+	for (fnum=0; fnum<CACHE_TEST_SIZE; fnum++) {
+		memset(buf, (char)fnum, 1024);
+		put_cart_cache(fnum, buf);
+	}
+	for (fnum=0; fnum<CACHE_TEST_SIZE/2; fnum++) {
+		get_cart_cache(fnum);
+	}
+
+	// Shrink to half the frames, the arena must fit the byte budget
+	if ( resize_cart_cache(cacheLayout(CACHE_TEST_SIZE/2, &lay)) || (cache->max!=CACHE_TEST_SIZE/2) ||
+			(cache->arenaBytes>cacheLayout(CACHE_TEST_SIZE/2, &lay)) || (cache->cap>cache->max) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, shrink.", policy->name);
+		return(-1);
+	}
+	resident=cacheResidentCheck(CACHE_TEST_SIZE);
+	if ( (resident<0) || (resident!=cache->cap) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frames lost in shrink.", policy->name);
+		return(-1);
+	}
+	if ( (policy==&policies[0]) && !admission && (cacheResidentCheck(CACHE_TEST_SIZE/2)!=CACHE_TEST_SIZE/2) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [lru] failed, shrink evicted recent frames.");
+		return(-1);
+	}
 
-	//set the start info
-	cache -> start -> prev = node;
-	
-	cache -> start=node;
+	// Grow to twice the frames and fill the new room
+	if ( resize_cart_cache(cacheLayout(CACHE_TEST_SIZE*2, &lay)) || (cache->max!=CACHE_TEST_SIZE*2) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, grow.", policy->name);
+		return(-1);
+	}
+	for (fnum=CACHE_TEST_SIZE; fnum<CACHE_TEST_SIZE*3; fnum++) {
+		memset(buf, (char)fnum, 1024);
+		put_cart_cache(fnum, buf);
+	}
+	resident=cacheResidentCheck(CACHE_TEST_SIZE*3);
+	if ( (resident<0) || (resident!=cache->cap) || (cache->cap>cache->max) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frames lost in grow.", policy->name);
+		return(-1);
+	}
 
+	// A pinned frame holds its place, no resize until it is let go
+	pinned=pin_cart_cache(CACHE_TEST_SIZE*3-1);
+	if ( (pinned==NULL) || (resize_cart_cache(cacheLayout(CACHE_TEST_SIZE, &lay))!=-1) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, resize with a pinned frame.", policy->name);
+		return(-1);
+	}
+	unpin_cart_cache(pinned);
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : get_cart_cache
-// Description  : Get an frame from the cache (and return it)
+// Function     : cacheL2Test
+// Description  : Stream more frames than the cache holds through it with a
+//                second tier big enough for all, every one must come back
+//                as a hit, and a new put must supersede the second tier copy
 //
-// Inputs       : cart - the cartridge number of the cartridge to find
-//                frm - the  number of the frame to find
-// Outputs      : pointer to cached frame or NULL if not found
-
-void * get_cart_cache( uint32_t file_num)
-{	
-	if(cache==NULL)
-		return(0);
-
-	if(cache->cap == -1)
-		return NULL;
-	cache_node* node=cache->start;
-	int i;
-	int x;
+// Inputs       : none (uses the current policy)
+// Outputs      : 0 if successful, -1 if failure
 
-	if(cache->cap<cache->max)
-		x=cache->cap;
-	else
-		x=cache->max;
+int cacheL2Test(void) {
 
-	for(i=0;i<x;i++)
-	{	if(file_num==node->file_num)
-		{	if(node==cache->start)
-				return(node->frame);
-			if(node==cache->end)
-			{
-				node->prev->next= NULL;
-				cache->end= node->prev;
-			}
-			else
-			{
-				node -> prev -> next = node -> next;
-				node -> next -> prev = node ->prev;
-			}
+	// Local variables
+	char buf[1024], *frame;
+	uint32_t fnum;
+	uint64_t misses;
+	int ret=0;
 
-			node->next= cache->start;
-			node->prev= NULL;
-			cache->start->prev=node;
-			cache->start=node;
+	set_cart_cache_l2(CACHE_TEST_L2_FILE, CACHE_TEST_FRAMES);
+	cache=NULL;
+	set_cart_cache_size(CACHE_TEST_SIZE);
+	if (init_cart_cache()) {
+		set_cart_cache_l2(NULL, 0);
+		return(-1);
+	}
 
-			return(node->frame);
+	// Everything evicted goes to the second tier and is promoted on a get
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		memset(buf, (char)fnum, 1024);
+		put_cart_cache(fnum, buf);
+	}
+	misses=stats.misses;
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		memset(buf, (char)fnum, 1024);
+		frame=get_cart_cache(fnum);
+		if ( (frame==NULL) || (memcmp(frame, buf, 1024)!=0) ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frame %u lost by the second tier.", policy->name, fnum);
+			ret=-1;
+			break;
 		}
+	}
+	if ( CART_CACHE_STATS && (stats.misses!=misses) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, second tier missed.", policy->name);
+		ret=-1;
+	}
 
-		node=node->next;
+	// A put of a frame in the second tier replaces it there
+	for (fnum=0; (fnum<CACHE_TEST_FRAMES-1) && (l2Find(fnum)==CACHE_NIL); fnum++);
+	memset(buf, 0xee, 1024);
+	put_cart_cache(fnum, buf);
+	frame=get_cart_cache(fnum);
+	if ( (l2Find(fnum)!=CACHE_NIL) || (frame==NULL) || (memcmp(frame, buf, 1024)!=0) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, stale second tier frame.", policy->name);
+		ret=-1;
 	}
 
-	//not in the cache
-	return(NULL);
+	close_cart_cache();
+	set_cart_cache_l2(NULL, 0);
+	if (access(CACHE_TEST_L2_FILE, F_OK)==0) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, second tier file left behind.", policy->name);
+		ret=-1;
+	}
+	return(ret);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : delete_cart_cache
-// Description  : Remove a frame from the cache (and return it)
+// Function     : cacheDeleteTest
+// Description  : Delete clean, dirty and second tier frames and check they
+//                are gone and nothing was written back
 //
-// Inputs       : cart - the cart number of the frame to remove from cache
-//                blk - the frame number of the frame to remove from cache
-// Outputs      : pointe buffer inserted into the object
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-void * delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk) {
-return(NULL);
+int cacheDeleteTest(void) {
+
+	// Local variables
+	char buf[1024];
+	uint32_t fnum;
+	int ret=0;
+
+	cacheTestDisk=calloc(CACHE_TEST_FRAMES, CART_FRAME_SIZE);
+	set_cart_cache_flusher(cacheTestFlush);
+	set_cart_cache_l2(CACHE_TEST_L2_FILE, CACHE_TEST_FRAMES);
+	writeback=1;
+	cache=NULL;
+	set_cart_cache_size(CACHE_TEST_SIZE);
+	init_cart_cache();
+
+	// Clean frames first, pushed into the second tier by dirty ones after
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		memset(buf, (char)fnum, 1024);
+		if (fnum<CACHE_TEST_FRAMES-CACHE_TEST_SIZE) {
+			put_cart_cache(fnum, buf);
+		} else {
+			write_cart_cache(fnum, buf);
+		}
+	}
+	cacheTestWrites=0;
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		delete_cart_cache(fnum/1024, fnum%1024);
+	}
+	for (fnum=0; fnum<CACHE_TEST_FRAMES; fnum++) {
+		if ( (probe_cart_cache(fnum)) || (l2Find(fnum)!=CACHE_NIL) || (get_cart_cache(fnum)!=NULL) ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, frame %u kept after delete.", policy->name, fnum);
+			ret=-1;
+			break;
+		}
+	}
+	if ( (cacheTestWrites!=0) || (cache->ndirty!=0) ) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, deleted frames written back.", policy->name);
+		ret=-1;
+	}
+	if (cache->cap!=0) {
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, deleted frames not back in the pool.", policy->name);
+		ret=-1;
+	}
+
+	close_cart_cache();
+	set_cart_cache_l2(NULL, 0);
+	writeback=0;
+	free(cacheTestDisk);
+	cacheTestDisk=NULL;
+	return(ret);
 }
 
+////////////////////////////////////////////////////////////////////////////////
 //
-// Unit test
+// Function     : cacheRunTests
+// Description  : Run every cache test against private caches, closing each
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cacheRunTests(void) {
+
+	// Local variables
+	int i, survivors;
+
+	// Run each policy through the model and scan tests
+	admission=0;
+	for (i=0; i<CACHE_NUM_POLICIES; i++) {
+		policy=&policies[i];
+		cache=NULL;
+		if ( set_cart_cache_size(CACHE_TEST_SIZE) || init_cart_cache() ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed on init.", policy->name);
+			return(-1);
+		}
+		if (cacheModelTest()) {
+			close_cart_cache();
+			return(-1);
+		}
+		close_cart_cache();
+
+		if ( cacheWritebackTest() || cacheL2Test() || cacheDeleteTest() ) {
+			return(-1);
+		}
+
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		if (cachePinTest()) {
+			close_cart_cache();
+			return(-1);
+		}
+		close_cart_cache();
+
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		if (cacheResizeTest()) {
+			close_cart_cache();
+			return(-1);
+		}
+		close_cart_cache();
+
+		// The scan resistant policies must keep the whole hot set
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		survivors=cacheScanTest();
+		close_cart_cache();
+		logMessage(LOG_INFO_LEVEL, "Cache unit test [%s], %d of %d hot frames survived scan.",
+			policy->name, survivors, CACHE_TEST_HOT);
+		if ( (i!=0) && (survivors!=CACHE_TEST_HOT) ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [%s] failed, scan flushed hot set.", policy->name);
+			return(-1);
+		}
+	}
+
+	// The admission filter must keep one-hit frames from flushing lru
+	policy=&policies[0];
+	for (admission=0; admission<=1; admission++) {
+		cache=NULL;
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		if ( admission && cacheModelTest() ) {
+			close_cart_cache();
+			return(-1);
+		}
+		close_cart_cache();
+
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		if ( admission && cacheResizeTest() ) {
+			close_cart_cache();
+			return(-1);
+		}
+		close_cart_cache();
+
+		set_cart_cache_size(CACHE_TEST_SIZE);
+		init_cart_cache();
+		survivors=cacheAdmissionTest();
+		close_cart_cache();
+		logMessage(LOG_INFO_LEVEL, "Cache unit test [lru%s], %d of %d hot frames survived stream.",
+			(admission) ? "+tinylfu" : "", survivors, CACHE_TEST_HOT);
+		if ( admission && (survivors<CACHE_TEST_HOT*3/4) ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test [lru+tinylfu] failed, stream flushed hot set.");
+			return(-1);
+		}
+	}
+
+	// Return successfully
+	return(0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -366,6 +2692,30 @@ return(NULL);
 
 int cartCacheUnitTest(void) {
 
+	// Local variables
+	Cache *saved=cache;
+	cache_policy *savedPolicy=policy;
+	int savedAdmission=admission, savedWriteback=writeback;
+	char *savedL2Path=l2Path;
+	uint32_t savedL2Frames=l2Frames;
+	int (*savedFlusher)(uint32_t, void *)=flusher;
+	int ret;
+
+	// Run the tests on private caches, then restore the driver's settings
+	l2Path=NULL;
+	l2Frames=0;
+	ret=cacheRunTests();
+	l2Path=savedL2Path;
+	l2Frames=savedL2Frames;
+	cache=saved;
+	policy=savedPolicy;
+	admission=savedAdmission;
+	writeback=savedWriteback;
+	flusher=savedFlusher;
+	if (ret) {
+		return(-1);
+	}
+
 	// Return successfully
 	logMessage(LOG_OUTPUT_LEVEL, "Cache unit test completed successfully.");
 	return(0);
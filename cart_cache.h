@@ -12,10 +12,32 @@
 //
 
 // Includes
+#include <stddef.h>
 #include <cart_controller.h>
 
 // Defines
 #define DEFAULT_CART_FRAME_CACHE_SIZE 1024  // Default size for cache
+#ifndef CART_CACHE_STATS
+#define CART_CACHE_STATS 1                  // Build with -DCART_CACHE_STATS=0 to drop the counters
+#endif
+
+// Cache instrumentation counters
+typedef struct {
+	uint64_t ops;        // gets and puts
+	uint64_t hits;       // gets that found the frame
+	uint64_t misses;     // gets that did not
+	uint64_t insertions; // puts that brought a new frame in
+	uint64_t overwrites; // puts that replaced a resident frame in place
+	uint64_t evictions;  // frames pushed out to make room
+	uint64_t rejects;    // new frames the admission filter turned away
+	uint64_t writebacks; // dirty frames written to the cartridges
+	uint64_t demotions;  // evicted frames kept in the second tier
+	uint64_t l2hits;     // hits served from the second tier
+	uint32_t occupancy;  // frames resident now
+	uint32_t peak;       // most frames ever resident
+	uint32_t dirty;      // frames resident and dirty now
+	uint32_t max_frames; // size of the cache
+} CartCacheStats;
 
 ///
 // Cache Interfaces
@@ -23,6 +45,27 @@
 int set_cart_cache_size(uint32_t max_frames);
 	// Set the size of the cache (must be called before init)
 
+int set_cart_cache_policy(const char *name);
+	// Select the replacement policy, lru, arc or 2q (must be called before init)
+
+int set_cart_cache_admission(int on);
+	// Turn the TinyLFU admission filter on or off (must be called before init)
+
+int set_cart_cache_writeback(int on);
+	// Keep written frames dirty in the cache until evicted or synced (before init)
+
+int set_cart_cache_l2(const char *path, uint32_t frames);
+	// Keep evicted clean frames in a mapped local file of frames (before init)
+
+int set_cart_cache_flusher(int (*flush)(uint32_t file_num, void *frame));
+	// Register the function used to write a frame out to the cartridges
+
+int resize_cart_cache(size_t bytes);
+	// Set the cache memory budget in bytes, a running cache is resized in place
+
+int set_cart_cache_memory_limit(size_t bytes);
+	// Shrink the cache when the process RSS passes bytes (0 turns it off)
+
 int init_cart_cache(void);
 	// Initialize the cache 
 
@@ -35,6 +78,36 @@ int put_cart_cache(uint32_t file_num, void *frame);
 void * get_cart_cache(uint32_t file_num);
 	// Get an object from the cache (and return it)
 
+uint32_t get_cart_cache_room(void);
+	// Get the number of new frames the cache takes before pushing one out
+
+int probe_cart_cache(uint32_t file_num);
+	// Check if a frame is in the cache without counting a reference
+
+void * pin_cart_cache(uint32_t file_num);
+	// Get a frame and pin it, eviction will not reuse it until it is unpinned
+
+int unpin_cart_cache(void *frame);
+	// Release a pin taken with pin_cart_cache
+
+int write_cart_cache(uint32_t file_num, void *frame);
+	// Write a frame through the cache (dirty in write-back mode, else to the carts)
+
+int sync_cart_cache(void);
+	// Write every dirty frame back to the cartridges, grouped by cartridge
+
+int flush_cart_cache(uint32_t file_num);
+	// Write one frame back if it is dirty
+
+int get_cart_cache_stats(CartCacheStats *stats);
+	// Copy out the cache counters (valid after close, -1 if compiled out)
+
+int set_cart_cache_snapshot(uint32_t every, void (*snap)(const CartCacheStats *stats));
+	// Hand a copy of the counters to snap every "every" gets/puts
+
+void * delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk);
+	// Remove a frame given back to the carts, dirty or not, without a write back
+
 //
 // Unit test
 
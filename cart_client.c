@@ -10,14 +10,25 @@
 // Include Files
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 // Project Include Files
 #include <cart_network.h>
 #include <cmpsc311_util.h>
 #include <cmpsc311_log.h> 
 #include <cart_driver.h>
+
+// Defines
+#define RING_ENTRIES 4  // a send and a receive are all the ring ever holds
+#define RING_SEND 1     // user_data of the send in the ring
+#define RING_RECV 2     // and of the receive
 //
 //  Global data
 int   client_socket = -1;
@@ -30,10 +41,81 @@ unsigned short     cart_network_port = 0;       // Port of CART serve
 unsigned long      CartControllerLLevel = LOG_INFO_LEVEL; // Controller log level (global)
 unsigned long      CartDriverLLevel = 0;     // Driver log level (global)
 unsigned long      CartSimulatorLLevel = 0;  // Driver log level (global)
+int                cart_network_window = CART_DEFAULT_WINDOW; // Requests in flight at most
+int                cart_network_uring = 1;   // 0 keeps the client on read/write
+
+// A request sent whose response has not been read yet
+typedef struct {
+	CartXferRegister reg; // the request
+	void *buf;            // where a read's frames go
+} CartInFlight;
+
+CartInFlight inflight[CART_MAX_WINDOW]; // oldest at inflight_head
+int    inflight_head = 0, inflight_count = 0;
+size_t inflight_bytes = 0;               // response bytes still to come
+
+// Requests go out through send_buf and responses come in through recv_buf,
+// recv_buf is registered with the ring when there is one
+char   send_buf[CART_STAGE_BYTES];
+size_t send_len = 0, send_done = 0;    // bytes queued, and sent of them
+char   recv_buf[CART_STAGE_BYTES];
+size_t recv_start = 0, recv_len = 0;   // bytes read and not taken yet
+CartXferRegister recv_reg;             // header of the oldest response
+size_t recv_got = 0;                   // bytes of the oldest response taken
+unsigned long bus_requests = 0, bus_syscalls = 0;
+
+// The io_uring of the connection, fd is -1 if there is none
+struct {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_size, cq_size, sqe_size;
+	int sending, receiving;           // the send/receive is in the ring
+} ring = { .fd = -1 };
+
+//
+// Functional Prototypes
+
+int send_all(int sock, const void *buf, size_t len); // write all of buf
+int32_t socket_ops();                                // connect to the server
+void ring_teardown(void);                            // close the io_uring
+int ring_setup(void);                                // set up the io_uring
+void ring_push(uint8_t op, void *addr, size_t len, uint64_t data); // add a send/receive to it
+void bus_reset(void);                                // drop the connection and what is in flight
+int transport_io(int want);                          // send and receive once
+int take_response(CartInFlight *req);                // take a response out of recv_buf
+size_t reply_bytes(CartXferRegister reg);            // bytes a request is answered with
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : send_all
+// Description  : send len bytes, however many writes the socket takes
+//
+// Inputs       : sock - the socket
+//                buf - the bytes
+//                len - how many
+// Outputs      : 0 if successful, -1 if failure
+
+int send_all(int sock, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		if( (n = send(sock, buf, len, MSG_NOSIGNAL)) <= 0 )
+			return (-1);
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+	return (0);
+}
+
 int32_t socket_ops()
 {
 	//there is no open connection.
@@ -60,12 +142,467 @@ int32_t socket_ops()
     if(connect(client_socket, (const struct sockaddr *) &client_addr, sizeof(client_addr)) == -1)
 	{
 		logMessage(LOG_ERROR_LEVEL, "error in socket_ops connection failed" );
+		close(client_socket);
+		client_socket = -1;
 		return (-1);
 	} 
 
+	//(d) Set up the io_uring, or stay on read/write
+	if( cart_network_uring && (ring_setup() == -1) )
+		logMessage(LOG_INFO_LEVEL, "CART client: no io_uring (%s), using read/write", strerror(errno));
+
+	return (0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_teardown
+// Description  : closes the connection's io_uring, the kernel drops its
+//                registered buffer and socket with it
+//
+// Inputs       : none
+// Outputs      : none
+
+void ring_teardown(void)
+{
+	if( (ring.sqes != NULL) && (ring.sqes != MAP_FAILED) )
+		munmap(ring.sqes, ring.sqe_size);
+	if( (ring.cq_map != NULL) && (ring.cq_map != MAP_FAILED) && (ring.cq_map != ring.sq_map) )
+		munmap(ring.cq_map, ring.cq_size);
+	if( (ring.sq_map != NULL) && (ring.sq_map != MAP_FAILED) )
+		munmap(ring.sq_map, ring.sq_size);
+	if( ring.fd != -1 )
+		close(ring.fd);
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_setup
+// Description  : sets up an io_uring for the connection, with recv_buf
+//                registered as a fixed buffer and the socket as a fixed
+//                file. Sends go in as IORING_OP_SEND with MSG_NOSIGNAL, so
+//                a server that went away is an error and not a SIGPIPE
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if there is no io_uring to be had
+
+int ring_setup(void)
+{
+	struct io_uring_params p;
+	struct iovec buf = { recv_buf, sizeof(recv_buf) };
+	char probe_ops[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+	struct io_uring_probe *probe = (struct io_uring_probe *)probe_ops;
+	int single;
+
+	memset(&p, 0, sizeof(p));
+	if( (ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p)) == -1 )
+		return (-1);
+
+	// the submission and completion rings, the kernel maps both at once if it can
+	single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( single && (ring.cq_size > ring.sq_size) )
+		ring.sq_size = ring.cq_size;
+	ring.sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sq_map = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	ring.cq_map = (single) ? ring.sq_map :
+	    mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes = mmap(NULL, ring.sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if( (ring.sq_map == MAP_FAILED) || (ring.cq_map == MAP_FAILED) || (ring.sqes == MAP_FAILED) )
+	{
+		ring_teardown();
+		return (-1);
+	}
+	ring.sq_tail  = (unsigned *)((char *)ring.sq_map + p.sq_off.tail);
+	ring.sq_mask  = (unsigned *)((char *)ring.sq_map + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)((char *)ring.sq_map + p.sq_off.array);
+	ring.cq_head  = (unsigned *)((char *)ring.cq_map + p.cq_off.head);
+	ring.cq_tail  = (unsigned *)((char *)ring.cq_map + p.cq_off.tail);
+	ring.cq_mask  = (unsigned *)((char *)ring.cq_map + p.cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe *)((char *)ring.cq_map + p.cq_off.cqes);
+
+	if( (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &buf, 1) == -1) ||
+	    (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES, &client_socket, 1) == -1) )
+	{
+		ring_teardown();
+		return (-1);
+	}
+
+	// kernels before 5.6 have no IORING_OP_SEND
+	memset(probe_ops, 0, sizeof(probe_ops));
+	if( (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == -1) ||
+	    (probe->last_op < IORING_OP_SEND) || ! (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) )
+	{
+		ring_teardown();
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_push
+// Description  : puts a send of send_buf or a read into the fixed recv_buf
+//                on the socket in the submission ring
+//
+// Inputs       : op - IORING_OP_SEND or IORING_OP_READ_FIXED
+//                addr - where in the buffer
+//                len - how many bytes
+//                data - RING_SEND or RING_RECV, comes back with the result
+// Outputs      : none
+
+void ring_push(uint8_t op, void *addr, size_t len, uint64_t data)
+{
+	unsigned tail = *ring.sq_tail, slot = tail & *ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0; // the socket, the first fixed file
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = len;
+	if( op == IORING_OP_SEND )
+		sqe->msg_flags = MSG_NOSIGNAL;
+	else
+		sqe->off = (uint64_t)-1; // a stream, no offset
+	sqe->user_data = data;
+	ring.sq_array[slot] = slot;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : transport_io
+// Description  : moves bytes once: sends what is queued in send_buf and,
+//                if asked, reads what has come into recv_buf. With a ring
+//                both go in with one io_uring_enter that waits for at least
+//                one of them, without it they are a write then a read. Short
+//                transfers just leave the rest for the next call
+//
+// Inputs       : want - 1 to read as well as send
+// Outputs      : 0 if successful, -1 if failure
+
+int transport_io(int want)
+{
+	struct io_uring_cqe *cqe;
+	unsigned submit = 0, head;
+	ssize_t n;
+	int bad = 0;
+
+	// a read only goes into recv_buf when nothing is waiting in it
+	if( want && ! ring.receiving && (recv_len == 0) )
+		recv_start = 0;
+
+	if( ring.fd == -1 )
+	{
+		if( send_done < send_len )
+		{
+			n = send(client_socket, &send_buf[send_done], send_len - send_done, MSG_NOSIGNAL);
+			bus_syscalls++;
+			if( (n == -1) && (errno == EINTR) )
+				return (0);
+			if( n <= 0 )
+				return (-1);
+			send_done += n;
+			if( send_done == send_len )
+				send_len = send_done = 0;
+			return (0);
+		}
+		if( want )
+		{
+			n = read(client_socket, &recv_buf[recv_start + recv_len], CART_STAGE_BYTES - recv_start - recv_len);
+			bus_syscalls++;
+			if( (n == -1) && (errno == EINTR) )
+				return (0);
+			if( n <= 0 )
+				return (-1);
+			recv_len += n;
+		}
+		return (0);
+	}
+
+	if( (send_done < send_len) && ! ring.sending )
+	{
+		ring_push(IORING_OP_SEND, &send_buf[send_done], send_len - send_done, RING_SEND);
+		ring.sending = 1;
+		submit++;
+	}
+	if( want && ! ring.receiving )
+	{
+		ring_push(IORING_OP_READ_FIXED, &recv_buf[recv_start + recv_len], CART_STAGE_BYTES - recv_start - recv_len, RING_RECV);
+		ring.receiving = 1;
+		submit++;
+	}
+	bus_syscalls++;
+	if( (syscall(__NR_io_uring_enter, ring.fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1) && (errno != EINTR) )
+		return (-1);
+
+	// what finished, a send or receive cut short is put back in next time
+	head = *ring.cq_head;
+	while( head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) )
+	{
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		if( cqe->user_data == RING_SEND )
+		{
+			ring.sending = 0;
+			if( cqe->res > 0 )
+				send_done += cqe->res;
+			else if( (cqe->res != -EINTR) && (cqe->res != -EAGAIN) )
+				bad = 1;
+		}
+		else
+		{
+			ring.receiving = 0;
+			if( cqe->res > 0 )
+				recv_len += cqe->res;
+			else if( (cqe->res != -EINTR) && (cqe->res != -EAGAIN) )
+				bad = 1; // 0 is the server hanging up
+		}
+		head++;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	if( (send_done == send_len) && ! ring.sending )
+		send_len = send_done = 0;
+	return (bad ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : take_response
+// Description  : takes the bytes of the oldest response out of recv_buf,
+//                the header into recv_reg and a read's frames into its buf
+//
+// Inputs       : req - the oldest request in flight
+// Outputs      : 1 if its response is all there, 0 if more has to be read
+
+int take_response(CartInFlight *req)
+{
+	size_t n, want;
+
+	if( recv_got < CART_NET_HEADER_SIZE )
+	{
+		n = (recv_len < CART_NET_HEADER_SIZE - recv_got) ? recv_len : CART_NET_HEADER_SIZE - recv_got;
+		memcpy((char *)&recv_reg + recv_got, &recv_buf[recv_start], n);
+		recv_start += n;
+		recv_len -= n;
+		recv_got += n;
+		if( recv_got < CART_NET_HEADER_SIZE )
+			return (0);
+	}
+
+	// the frames of a read, a failed batch has none
+	want = 0;
+	if( (req->reg >> 56) == CART_OP_RDFRME )
+		want = CART_FRAME_SIZE;
+	else if( ((req->reg >> 56) == CART_OP_RDFRMS) && (((ntohll64(recv_reg) >> 47) & 1) == 0) )
+		want = (size_t)(req->reg & CART_FC1_MASK) * CART_FRAME_SIZE;
+	want -= recv_got - CART_NET_HEADER_SIZE;
+
+	n = (recv_len < want) ? recv_len : want;
+	memcpy((char *)req->buf + (recv_got - CART_NET_HEADER_SIZE), &recv_buf[recv_start], n);
+	recv_start += n;
+	recv_len -= n;
+	recv_got += n;
+	return (n == want);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reply_bytes
+// Description  : how many bytes the server answers a request with
+//
+// Inputs       : reg - the request
+// Outputs      : the header and any frames coming back
+
+size_t reply_bytes(CartXferRegister reg)
+{
+	switch(reg >> 56)
+	{
+		case CART_OP_RDFRME: return (CART_NET_HEADER_SIZE + CART_FRAME_SIZE);
+		case CART_OP_RDFRMS: return (CART_NET_HEADER_SIZE + (size_t)(reg & CART_FC1_MASK) * CART_FRAME_SIZE);
+		default:             return (CART_NET_HEADER_SIZE);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_client_bus_room
+// Description  : says if a request can go out now without going past the
+//                window, in requests or in response bytes still to come.
+//                A request always fits when nothing is in flight
+//
+// Inputs       : reg - the request
+// Outputs      : 1 if it fits, 0 if the oldest response has to be read first
+
+int cart_client_bus_room(CartXferRegister reg)
+{
+	int window = cart_network_window;
+
+	if( inflight_count == 0 )
+		return (1);
+	if( window > CART_MAX_WINDOW )
+		window = CART_MAX_WINDOW;
+	return( (inflight_count < window) && (inflight_bytes + reply_bytes(reg) <= CART_WINDOW_BYTES) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_client_bus_pending
+// Description  : how many requests are waiting for their responses
+//
+// Inputs       : none
+// Outputs      : the requests in flight
+
+int cart_client_bus_pending(void)
+{
+	return (inflight_count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_client_bus_submit
+// Description  : queues a request for the server without waiting for the
+//                response, which cart_client_bus_complete reads later. A
+//                write's frames are copied out, so buf can be reused on
+//                return, a read's frames land in buf when it completes
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the frames to be read/written (READ/WRITE)
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_client_bus_submit(CartXferRegister reg, void *buf)
+{
+	CartXferRegister net_reg = htonll64(reg);
+	size_t payload = 0;
+
+	if( (client_socket == -1) && (socket_ops() == -1) )
+	{
+		logMessage(LOG_ERROR_LEVEL, "error in socket_ops" );
+		return (-1);
+	}
+	if( ! cart_client_bus_room(reg) )
+	{
+		logMessage(LOG_ERROR_LEVEL, "error in bus submit, window full (%d in flight)", inflight_count);
+		return (-1);
+	}
+
+	if( (reg >> 56) == CART_OP_WRFRME )
+		payload = CART_FRAME_SIZE;
+	else if( (reg >> 56) == CART_OP_WRFRMS )
+		payload = (size_t)(reg & CART_FC1_MASK) * CART_FRAME_SIZE;
+
+	// send what is queued first if this does not fit behind it
+	while( (send_len > 0) && (send_len + sizeof(net_reg) + payload > CART_STAGE_BYTES) )
+		if( transport_io(0) == -1 )
+		{
+			logMessage(LOG_ERROR_LEVEL, "error in bus submit write failed");
+			bus_reset();
+			return (-1);
+		}
+
+	if( sizeof(net_reg) + payload > CART_STAGE_BYTES )
+	{
+		// bigger than send_buf, it goes straight out
+		if( (send_all(client_socket, &net_reg, sizeof(net_reg)) == -1) ||
+		    (send_all(client_socket, buf, payload) == -1) )
+		{
+			logMessage(LOG_ERROR_LEVEL, "error in bus submit write failed");
+			bus_reset();
+			return (-1);
+		}
+		bus_syscalls += 2;
+	}
+	else
+	{
+		// QUEUE: (reg) <- Network format, then the frames of a write
+		memcpy(&send_buf[send_len], &net_reg, sizeof(net_reg));
+		if( payload > 0 )
+			memcpy(&send_buf[send_len + sizeof(net_reg)], buf, payload);
+		send_len += sizeof(net_reg) + payload;
+	}
+
+	inflight[(inflight_head + inflight_count) % CART_MAX_WINDOW].reg = reg;
+	inflight[(inflight_head + inflight_count) % CART_MAX_WINDOW].buf = buf;
+	inflight_count++;
+	inflight_bytes += reply_bytes(reg);
 	return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_client_bus_complete
+// Description  : reads the response to the oldest request in flight, the
+//                server answers in the order it was asked. Requests still
+//                queued go out on the way. A transport error fails every
+//                request in flight, the next submit connects again
+//
+// Inputs       : none
+// Outputs      : the response structure encoded as needed, -1 if failure
+
+CartXferRegister cart_client_bus_complete(void)
+{
+	CartInFlight *req = &inflight[inflight_head];
+
+	if( inflight_count == 0 )
+	{
+		logMessage(LOG_ERROR_LEVEL, "error in bus complete, nothing in flight");
+		return (-1);
+	}
+
+	// RECEIVE: (reg) -> Host format, and the frames of a read
+	while( ! take_response(req) )
+		if( transport_io(1) == -1 )
+		{
+			logMessage(LOG_ERROR_LEVEL, "error in bus complete read failed, %d requests in flight lost", inflight_count);
+			bus_reset();
+			return (-1);
+		}
+	inflight_head = (inflight_head + 1) % CART_MAX_WINDOW;
+	inflight_count--;
+	inflight_bytes -= reply_bytes(req->reg);
+	recv_got = 0;
+	bus_requests++;
+
+	// Close the socket when finished (SHUTDOWN)
+	if( (req->reg >> 56) == CART_OP_POWOFF )
+	{
+		logMessage(LOG_INFO_LEVEL, "CART client: %lu requests in %lu transport system calls (%s)",
+			bus_requests, bus_syscalls, (ring.fd != -1) ? "io_uring" : "read/write");
+		bus_reset();
+		bus_requests = bus_syscalls = 0;
+	}
+
+	return ntohll64(recv_reg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_reset
+// Description  : closes the connection and its io_uring and forgets the
+//                requests in flight and the bytes staged for them, after a
+//                power off or when the connection breaks
+//
+// Inputs       : none
+// Outputs      : none
+
+void bus_reset(void)
+{
+	ring_teardown();
+	if( client_socket != -1 )
+		close(client_socket);
+	client_socket = -1;
+	inflight_head = inflight_count = 0;
+	inflight_bytes = 0;
+	send_len = send_done = 0;
+	recv_start = recv_len = recv_got = 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -77,137 +614,20 @@ int32_t socket_ops()
 //                2) send any request to the server, returning results
 //                3) if CLOSE, will close the connection
 //
+//                Requests still in flight are completed first, so the
+//                response read is the one for this request
+//
 // Inputs       : reg - the request reqisters for the command
 //                buf - the block to be read/written from (READ/WRITE)
 // Outputs      : the response structure encoded as needed
 
 CartXferRegister cart_client_bus_request(CartXferRegister reg, void *buf)
 {
-	 if( client_socket == -1)
-  		if(socket_ops() ==-1)
-  		{
-  			logMessage(LOG_ERROR_LEVEL, "error in socket_ops" );	
+	while( inflight_count > 0 )
+		if( cart_client_bus_complete() == (CartXferRegister)-1 )
 			return (-1);
-  		}
-
-
-     uint8_t   ky1, ky2, rt1;
-     uint16_t ct1,fm1;
-     
-     unstitch(reg, &ky1,&ky2,&rt1,&ct1,&fm1);
-
-  	 CartXferRegister net_reg =htonll64(reg);
-
-	 switch(ky1)
-	 {
-
- 		case CART_OP_RDFRME: // CASE 1: RD operation
-	 		// Send the register reg to the network after converting the register to 'network format'.
-	    	// SEND: (reg) <- Network format 
- 			if(write(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME write1 failed");
-				return(-1);
-	
- 			}
-
-	    	// RECEIVE: (reg) -> Host format
- 			if(read(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME read1 failed");
-				return(-1);
-	
- 			}
-    	    // RECEIVE: 1024 frame (Data read from that frame)
- 			if(read(client_socket, buf, 1024) != 1024)
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME read2 failed");
-				return(-1);
-	
- 			}
-
-		break;
-
- 		case CART_OP_WRFRME: // CASE 2: WR operation
-			// Send the register reg to the network after converting the register to 'network format'.
-			// SEND: (reg) <- Network format
- 		 	if(write(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in WRFRME write1 failed");
-				return(-1);
-	
- 			}
-
-	    	//SEND: buf 1024 (Data to write to that frame)
- 			if(write(client_socket, buf, 1024) != 1024)
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in WRFRME write2 failed");
-				return(-1);
-	
- 			}
-
-	    	// RECEIVE:
-	    	// (reg) -> Host format
- 			if(read(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in WRFRME read1 failed");
-				return(-1);
-	
- 			}
-
-
-
-		break; 
-
- 		case CART_OP_POWOFF: // CASE 3: SHUTDOWN operation
-			// Send the register reg to the network after converting the register to 'network format'.
-			// SEND: (reg) <- Network format 
- 			if(write(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME write1 failed");
-				return(-1);
-	
- 			}
-
-
-	    	// RECEIVE:
-	    	// (reg) -> Host format
- 			if(read(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
- 			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME read1 failed");
-				return(-1);
-			}
-
-
-			// reset socket_handle to initial value of -1.
-			// Close the socket when finished (SHUTDOWN) : 
-		     close(client_socket);
-			 client_socket =-1;
-
-		break;
-
- 		default: // CASE 4: Other operation
-			// Send the register reg to the network after converting the register to 'network format'.
-			// SEND: (reg) <- Network format 
-			if(write(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
-	 			{
-					logMessage(LOG_ERROR_LEVEL, "error in RDFRME write1 failed");
-					return(-1);
-		
-	 			}
-
-		    	// RECEIVE:
-		    	// (reg) -> Host format
-			if(read(client_socket, &net_reg, sizeof(net_reg)) != sizeof(net_reg))
-			{
-				logMessage(LOG_ERROR_LEVEL, "error in RDFRME read1 failed");
-				return(-1);
-			}
-
-			unstitch(ntohll64(net_reg), &ky1, &ky2, &rt1, &ct1, &fm1);
-		
-	 }
-
-	return ntohll64(net_reg);
-
-}
\ No newline at end of file
+
+	if( cart_client_bus_submit(reg, buf) == -1 )
+		return (-1);
+	return cart_client_bus_complete();
+}
@@ -19,6 +19,7 @@
 #define CART_CARTRIDGE_SIZE 1024
 #define CART_FRAME_SIZE 1024
 #define CART_NO_CARTRIDGE (CART_MAX_CARTRIDGES+0xff)
+#define CART_FC1_MASK 0x7fff // FC1 is the low 15 bits of the register
 
 // Type definitions
 typedef uint64_t CartXferRegister; // This is the value passed through the 
@@ -39,7 +40,11 @@ typedef CartFrame CartCartridge[CART_CARTRIDGE_SIZE]; // A Cartridge
     16 - RT1 (Return code register 1)
  17-32 - CT1 (Cartridge register 1)
  33-48 - FM1 (Frame register 1)
- 48-63 - UNUSED
+ 49-63 - FC1 (Frame count register 1, RDFRMS/WRFRMS only)
+
+ RDFRMS and WRFRMS move FC1 frames of the loaded cartridge from FM1 on,
+ the frames follow the register on the wire (WRFRMS) or in the reply
+ (RDFRMS, none if RT1 is set). A server without them answers RT1 set.
 
 */
 
@@ -51,7 +56,8 @@ typedef enum {
 	CART_REG_RT1 = 2,   // Return code 1 (1 bit)
 	CART_REG_CT1 = 3,   // Cartridge register 1
 	CART_REG_FM1 = 4,   // Frame register 1
-	CART_REG_MAXVAL = 5 // Maximum opcode value
+	CART_REG_FC1 = 5,   // Frame count register 1
+	CART_REG_MAXVAL = 6 // Maximum opcode value
 
 } CartRegisters;
 
@@ -64,7 +70,9 @@ typedef enum {
 	CART_OP_RDFRME = 3,  // Read the cartidge frame
 	CART_OP_WRFRME = 4,  // Write to the cartridge frame
 	CART_OP_POWOFF = 5,  // Power off the memory system
-	CART_OP_MAXVAL = 6   // Maximum opcode value
+	CART_OP_RDFRMS = 6,  // Read FC1 frames of the cartridge
+	CART_OP_WRFRMS = 7,  // Write FC1 frames of the cartridge
+	CART_OP_MAXVAL = 8   // Maximum opcode value
 
 } CartOpCodes;
 
@@ -11,6 +11,9 @@
 // Includes
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
 
 // Project Includes
 #include <cart_cache.h>
@@ -18,30 +21,118 @@
 #include <cart_controller.h> 
 #include <cart_network.h>
 #include <cmpsc311_log.h>
-//Structure 
 
+// Defines
+#define CART_CHAIN_END 65535 // next[] value after the last frame of a file
+#define RA_TRIGGER 2 // sequential frame steps before reading ahead
+#define RA_INIT_WINDOW 4 // frames read ahead when a file goes sequential
+#define RA_MAX_WINDOW 64 // most frames kept read ahead of a reader
+#define RA_CACHE_SHARE 4 // and at most 1/RA_CACHE_SHARE of the room for new frames
+#define EXT_INIT_SIZE 4 // extents allocated for a new file
+#define NAME_INIT_SIZE 64 // namespace entries (and hash buckets) to start with
+#define NAME_ROOT 0 // namespace entry of the top directory
+#define NAME_NIL -1 // null index for the namespace links
+#define FILE_INIT_SIZE 64 // inodes and descriptors to start with, both double on demand
+#define FILE_MAX_FDS 32768 // descriptors, file handles are int16_t
+#define ALLOC_MIN_RUN 8 // frames reserved for a file at a time, at least
+#define ALLOC_MAX_RUN 128 // and at most, in between it is the frames the file has
+#define IOQ_DEPTH 128 // frame writes held back to go out grouped by cart
+#define IOQ_NIL -1 // null index for the write queue links
+#define META_SUPER 0 // cart*1024+frame of the superblock, cart 0 frame 0
+#define META_MAGIC 0x4d545243 // "CRTM", a superblock was written here
+#define META_VERSION 2 // checkpoint format
+#define META_MAX_RUNS 240 // runs of frames a checkpoint can be in, the superblock fits in a frame
+#define BUS_BATCH 64 // most frames one RDFRMS/WRFRMS request moves
+#define AIO_RING 256 // async requests waiting for the I/O thread at most, a power of two
+#define AIO_QUEUED 1 // CartAio state, submitted
+#define AIO_DONE 2 // and finished, result is good
+#define AIO_CLOSED (1ull<<32) // in the ring's tail once the stop is put, nothing goes after it
+#define DRV_TEST_BYTES 5000 // buffer of the driver unit test, not a whole number of frames
+#define DRV_TEST_ROUNDS 7 // writes of it per file, and async requests at once
 
-// files construct
-struct Filer{
-     char path[128];
+//Structure 
+
+// run of frames that follow each other on the carts, in file order
+struct Extent{
+     uint32_t first;//index in the file of the run's first frame
+     uint16_t file_num;//cart*1024+frame of the run's first frame
+     uint16_t length;//frames in the run
+};
+
+// namespace entry, a file or a directory
+struct Name{
+     char path[CART_MAX_PATH_LENGTH];//full path, no leading /
+     int8_t dir;//1 for a directory, 0 for a file
+     int32_t file;//inode of a file
+     int32_t parent;//directory the entry is in
+     int32_t child;//first entry in a directory
+     int32_t prev, next;//siblings in the same directory, free chain through next
+     int32_t hnext;//next entry in the same hash bucket
+};
+
+// hash indexed namespace, every file and directory by path
+struct Namespace{
+     struct Name* e;//entries, grown on demand
+     int32_t cap;//entries allocated
+     int32_t count;//entries in use
+     int32_t freeName;//first unused entry
+     int32_t* table;//hash buckets, a power of 2 of them
+     uint32_t mask;//buckets - 1
+} names;
+
+// file on the carts, the same however many descriptors have it open
+struct Inode{
      uint16_t start;//start num
+     uint32_t length;// total length of the file
+     int8_t used;//-1 free slot, 0 a file
+     int32_t opens;//descriptors open on the file
+     struct Extent* ext;//extent map of the file, sorted by first
+     uint32_t nExt, capExt;//extents in use and allocated
+     int32_t name;//namespace entry of the file
+     uint16_t resv;//next frame of the run reserved for the file
+     uint16_t nResv;//frames left in the run
+     int32_t nextFree;//free chain
+};
+
+// inode table, an inode number is the position in the array
+struct Inode* inodes=NULL;
+int32_t capInodes=0;
+int32_t freeInode=-1;
+
+// files construct, an open file description
+struct Filer{
+     int32_t inode;//file the descriptor is open on
      uint16_t file_num;    
      uint16_t file_pos;
-     uint32_t length;// total length of the file
-     int8_t used;
-     uint32_t curr_len;
-     int8_t offset;
-
-    
-} myFiles[ CART_MAX_TOTAL_FILES ];//file handle is the positon in the myFiles array   
+     int8_t used;//-1 never used, 0 closed, 1 open
+     uint32_t curr_len;//position in the file
+     int32_t ra_last;//frame the reader was last in, -1 for none
+     uint16_t ra_head;//last frame read ahead
+     uint16_t ra_pending;//frames read ahead the reader has not reached yet
+     uint16_t ra_window;//frames to keep read ahead, grows on hits and shrinks on waste
+     uint16_t ra_seq;//sequential frame steps in a row
+     uint32_t ra_issued, ra_hits, ra_wasted;//readahead counts for the file
+     int32_t nextFree;//free chain
+};
+
+// descriptor table, file handle is the positon in the myFiles array
+struct Filer* myFiles=NULL;
+int32_t capFiles=0;
+int32_t freeFile=-1;
 
 
 // data storage table
 struct Table
-{   uint16_t new;
-    int8_t cache_flag;
+{   int8_t cache_flag;
     int8_t flag; //1 if power is on  or 0 if power is off
+    int8_t batch; //1 if the server takes RDFRMS/WRFRMS
     int16_t cUsed[CART_MAX_CARTRIDGES];//number of frames used full in carts
+    int16_t cFree[CART_MAX_CARTRIDGES];//frames in carts not given to a file
+    int16_t cResv[CART_MAX_CARTRIDGES];//frames given to a file's run it has not used yet
+    uint32_t freeMap[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE/32];//a bit per frame, set once it is given to a file
+    uint16_t cHint[CART_MAX_CARTRIDGES];//frame after the last run taken, the next search starts there
+    uint32_t loads;//cartridge loads since power on
+    uint32_t formatted[(CART_MAX_CARTRIDGES+31)/32];//a bit per cart, set once it is zeroed
     CartridgeIndex cI;//current cart index
     struct Cartridge
      {  
@@ -50,6 +141,67 @@ struct Table
         
      } cart[CART_MAX_CARTRIDGES];
 }tab;
+
+// frames of the reads in flight, and of one batched write being sent
+char busBuf[BUS_BATCH*CART_FRAME_SIZE];
+char busOut[BUS_BATCH*CART_FRAME_SIZE];
+
+// run of frames a checkpoint is written in
+struct MetaRun{
+     uint16_t file_num;//cart*1024+frame of the first frame
+     uint16_t length;//frames
+};
+
+// superblock, says where the last checkpoint of the metadata is. The
+// checkpoint is a uint32_t count of records, then for each directory and
+// file, parents before children: uint8_t dir, uint8_t path length, the
+// path, and for a file uint32_t length, uint32_t runs and the runs of the
+// file as MetaRun
+struct MetaSuper{
+     uint32_t magic;//META_MAGIC
+     uint16_t version;//META_VERSION
+     uint16_t nRuns;//runs the checkpoint is in
+     uint32_t generation;//checkpoints written to this set of carts
+     uint32_t bytes;//length of the checkpoint
+     uint32_t sum;//FNV-1a of the checkpoint
+     uint32_t superSum;//FNV-1a of the superblock, taken with this field 0
+     uint32_t formatted[(CART_MAX_CARTRIDGES+31)/32];//carts zeroed when it was written
+     struct MetaRun runs[META_MAX_RUNS];
+} meta;//the checkpoint on the carts now, its frames are freed by the next one
+
+// checkpoint being built
+struct MetaBuf{
+     uint8_t* b;
+     uint32_t len, cap;
+};
+
+// frame writes waiting to go to the carts, a list for each cart
+struct IoQueue
+{   char data[IOQ_DEPTH][CART_FRAME_SIZE];
+    uint16_t file_num[IOQ_DEPTH];//cart*1024+frame of each write
+    int8_t busy[IOQ_DEPTH];//1 if the slot holds a write
+    int16_t next[IOQ_DEPTH];//next write for the same cart, free chain
+    int16_t head[CART_MAX_CARTRIDGES], tail[CART_MAX_CARTRIDGES];//writes for each cart, oldest first
+    int16_t freeSlot;//first unused slot
+    int16_t count;//writes waiting
+    int16_t slot[CART_MAX_CARTRIDGES*CART_CARTRIDGE_SIZE];//slot holding each frame, only good if the slot agrees
+    uint32_t queued, merged, sent;//writes taken, writes folded into one waiting, frames sent
+}ioq;
+
+// async requests, any thread puts them in the ring and the I/O thread takes them out
+struct AioRing
+{   CartAio* req[AIO_RING];
+    uint32_t seq[AIO_RING];//slot i takes request pos when seq==pos, holds it when seq==pos+1
+    uint64_t tail;//next position to put at in the low 32 bits and AIO_CLOSED, claimed with a compare and swap
+    uint32_t head;//next position to take from, the I/O thread's alone
+    sem_t ready;//requests put in the ring
+    pthread_mutex_t lock;//waiters sleep on done
+    pthread_cond_t done;
+    pthread_t thread;
+    int8_t on;//1 while the I/O thread runs
+    uint32_t submitted, taken, finished;
+}aio;
+sem_t driverHold;//the driver unit test lets a held async request finish
   
 
     // global declarations
@@ -80,27 +232,119 @@ int unstitch(CartXferRegister reg, uint8_t *ky1, uint8_t *ky2,uint8_t *rt1, uint
 //Universal helper Function to Load the Cart and check if loaded
 uint16_t loadCart(uint16_t cartNum);
 
+//frame allocation
+uint16_t allocFrame(int32_t ino);
+uint16_t allocRun(uint16_t cart, uint16_t from, uint16_t want, uint16_t* first);
+void allocRelease(int32_t ino);
+void allocSteal(uint16_t cart);
+void allocMark(uint16_t file_num);
+void frameFree(uint16_t file_num);
+
+//metadata checkpoint and mount
+int metaSave();
+int metaLoad();
+int metaRunOk(const struct MetaRun* run);
+void metaFree(const struct MetaSuper* sb);
+int metaPut(struct MetaBuf* mb, const void* data, uint32_t n);
+int metaTake(const uint8_t* b, uint32_t bytes, uint32_t* at, void* out, uint32_t n);
+uint32_t metaSum(const uint8_t* b, uint32_t n);
+
 // cart_power_on/off and helper functions
 int32_t cart_poweron(void);
 int32_t cart_poweroff(void); 
 int initCache();
 int initCart();
 int zeroCart();
+void resetCart(uint16_t cart);
+int formatCart(uint16_t cart);
+int cartFormatted(uint16_t cart);
+int16_t cartRoom(uint16_t cart);
 int powerOff();
 
 
 //cart_open/close and helper functions
 int16_t cart_open(char* path);
 int16_t cart_close(int16_t fd);
-int16_t findFile(char* path);
+int32_t cart_delete(char *path);
+int32_t cart_truncate(int16_t fd, uint32_t length);
+int32_t findFile(char* path);
+void freeFiles();
+int32_t inodeAlloc();
+void inodeFree(int32_t ino);
+int32_t fileAlloc();
+int initNames();
+void freeNames();
+const char* cleanPath(const char* path);
+uint32_t nameHash(const char* path);
+int32_t nameFind(const char* path);
+int32_t nameAdd(const char* path, int8_t dir, int32_t file);
+void nameRemove(int32_t n);
 
 
 //cart_read/write and helper functions
 int32_t cart_read(int16_t fd, void *buf, int32_t count);
 int32_t cart_write(int16_t fd, void *buf, int32_t count);
 int32_t cart_seek(int16_t fd, uint32_t loc); 
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t offset);
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t offset);
+int32_t cart_readv(int16_t fd, const struct iovec *iov, int iovcnt);
+int32_t cart_writev(int16_t fd, const struct iovec *iov, int iovcnt);
+int32_t ioAt(int16_t fd, const struct iovec* iov, int iovcnt, uint32_t offset, int write);
+int32_t readFrames(int16_t fd, const struct iovec* iov, int iovcnt);
+int32_t writeFrames(int16_t fd, const struct iovec* iov, int iovcnt);
+int fdCheck(int16_t fd, const char* who);
+int64_t iovTotal(const struct iovec* iov, int iovcnt);
+int iovSkip(const struct iovec* iov, int iovcnt, int* v, size_t* vo);
+int32_t iovMove(const struct iovec* iov, int iovcnt, int* v, size_t* vo, char* frame, int32_t n, int toFrame);
 int32_t writer(uint16_t cart, uint16_t frame, void* buf);
 int32_t reader(uint16_t cart, uint16_t frame, void* buf);
+int32_t fetchFrame(uint16_t cart, uint16_t frame, void* buf);
+void raReset(int16_t fd);
+void readAhead(int16_t fd);
+void raReport(int16_t fd);
+int extAppend(int32_t ino, uint16_t file_num);
+uint16_t extFind(int32_t ino, uint32_t index);
+char* pinFrame(uint16_t cart, uint16_t frame, char* spare);
+void unpinFrame(char* src, char* spare);
+int flushFrame(uint32_t file_num, void* buf);
+int writeFrame(uint32_t file_num, void* buf);
+int readFrame(uint32_t file_num, void* buf);
+int writeRun(uint32_t file_num, uint16_t n, void* buf);
+int readRun(uint32_t file_num, uint16_t n, void* buf);
+int32_t fetchRun(uint16_t file_num, uint32_t frames);
+int busPost(CartXferRegister reg, void* buf);
+int busReap();
+
+//asynchronous reads and writes
+int aioStart();
+void aioStop();
+int aioPut(CartAio* req);
+void* aioThread(void* arg);
+int32_t aioSubmit(CartAio* req, int8_t write);
+void aioDrain();
+
+//write queue
+void ioqInit();
+int16_t ioqSlot(uint16_t file_num);
+int ioqGet(uint16_t file_num, void* buf);
+void ioqCancel(uint16_t file_num);
+int ioqSend(int16_t* order, int k);
+int ioqDrainCart(uint16_t cart);
+int ioqDrain();
+int ioqDrainFile(int32_t ino);
+
+//driver unit test
+void driverFill(char* buf, uint32_t n, uint32_t seed);
+int driverCheck(int ok, const char* what);
+uint32_t driverFreeFrames();
+int driverIoTest();
+int driverReuseTest();
+int driverDirTest();
+int driverShareTest();
+int driverMountTest();
+void driverAioDone(CartAio* req);
+void driverAioHeld(CartAio* req);
+int driverAioTest();
 
 
 
@@ -113,7 +357,7 @@ int32_t reader(uint16_t cart, uint16_t frame, void* buf);
 int initCache()
 {   
     
-    
+    set_cart_cache_flusher(flushFrame);//dirty frames leave the cache through here
     int x=init_cart_cache();
     if(x == -1)    
     {   
@@ -121,6 +365,7 @@ int initCache()
       logMessage(LOG_ERROR_LEVEL,"Error @ cache init ");
       return(-1);
     }
+    tab.cache_flag=1;//so poweroff closes the cache
     return(0);
 }
 
@@ -242,6 +487,13 @@ int initCart()
          return(-1);
     }
     tab.flag=1;
+
+    //a server that moves batches of frames takes a batch of none, one that does not fails it
+    sReg= stitch(CART_OP_RDFRMS,0,0,0,0);
+    rReg=cart_client_bus_request(sReg, NULL);
+    unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1);
+    tab.batch=(rRT1==0);
+    logMessage(LOG_INFO_LEVEL,"CART driver: server %s batched frames",(tab.batch) ? "takes" : "does not take");
     return(0);
 }
 
@@ -272,21 +524,98 @@ int zeroCart()
         return(-1);
     }
    
-    tab.cUsed[tab.cI]=0;
+    resetCart(tab.cI);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resetCart
+// Description  : sets a cart's tables to empty and marks it formatted, after
+//                it is zeroed or before a mount fills its tables back in
+//
+// Inputs       : cart - the cart
+// Outputs      : none
+void resetCart(uint16_t cart)
+{
+    tab.cUsed[cart]=0;
+    tab.cFree[cart]=CART_CARTRIDGE_SIZE;
+    tab.cResv[cart]=0;
+    tab.cHint[cart]=0;
+    memset(tab.freeMap[cart],0,sizeof(tab.freeMap[cart]));
+    tab.formatted[cart/32]|=1u<<(cart%32);
+
+    //the last frame's number is the end of chain mark and the first is the superblock, never give them out
+    if(cart==CNF(CART_CHAIN_END))
+        allocMark(CART_CHAIN_END);
+    if(cart==CNF(META_SUPER))
+        allocMark(META_SUPER);
     
     int x=0;
     
     //zero the Table tab where cart is zerod
     for(x=0;x<1024;x++)//access all frames in curr cart
     { 
-        tab.cart[tab.cI].fUsed[x]=0;//all frames have 0 bits written
-        tab.cart[tab.cI].next[x]=-1;//all next values are null
+        tab.cart[cart].fUsed[x]=0;//all frames have 0 bits written
+        tab.cart[cart].next[x]=-1;//all next values are null
     }
+}
+
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatCart
+// Description  : loads and zeros a cart the first time a file needs a frame
+//                in it, so power on does not have to go through every cart
+//
+// Inputs       : cart - the cart
+// Outputs      : 0 if successful, -1 if failure
+int formatCart(uint16_t cart)
+{
+    if(loadCart(cart)>1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @formatCart cannot load cart %u",cart);
+        return(-1);
+    }
+    if(zeroCart()!=0)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @formatCart cannot zero cart %u",cart);
+        return(-1);
+    }
     return(0);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartFormatted
+// Description  : tells if a cart has been zeroed since power on
+//
+// Inputs       : cart - the cart
+// Outputs      : 1 if it has, 0 if not
+int cartFormatted(uint16_t cart)
+{
+    return((tab.formatted[cart/32]>>(cart%32)) & 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartRoom
+// Description  : frames a cart has not given to any file, a cart that is not
+//                formatted yet has all of them
+//
+// Inputs       : cart - the cart
+// Outputs      : free frames
+int16_t cartRoom(uint16_t cart)
+{
+    if(!cartFormatted(cart))
+        return((cart==CNF(CART_CHAIN_END)) ? CART_CARTRIDGE_SIZE-1 : CART_CARTRIDGE_SIZE);
+    return(tab.cFree[cart]);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : loadCart
@@ -316,10 +645,208 @@ uint16_t loadCart(uint16_t cartNum)
         return(-1);
     }
     tab.cI=cartNum;
+    tab.loads++;
     return(0);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocFrame
+// Description  : hands out the next frame for a file. Frames come from a run
+//                reserved for the file inside one cartridge, so a file's
+//                frames follow each other and its reads stay on one cart. A
+//                new run goes after the file's last frame if it can, else in
+//                the loaded cart, else in the first cart with room
+//
+// Inputs       : ino - the file's inode
+// Outputs      : cart*1024+frame, CART_CHAIN_END if the carts are full
+//
+uint16_t allocFrame(int32_t ino)
+{
+    struct Inode* f=&inodes[ino];
+    struct Extent* last=(f->nExt>0) ? &f->ext[f->nExt-1] : NULL;
+    uint16_t want, got=0, c, end;
+
+    if(f->nResv==0)
+    {
+        //reserve as many frames as the file has, a growing file gets longer runs
+        want=(last!=NULL) ? last->first+last->length : 0;
+        if(want<ALLOC_MIN_RUN)
+            want=ALLOC_MIN_RUN;
+        if(want>ALLOC_MAX_RUN)
+            want=ALLOC_MAX_RUN;
+
+        end=(last!=NULL) ? last->file_num+last->length-1 : CART_CHAIN_END;
+        if(tab.cI<CART_MAX_CARTRIDGES && tab.cFree[tab.cI]==0 && tab.cResv[tab.cI]>0)
+            allocSteal(tab.cI);
+        if(tab.cI<CART_MAX_CARTRIDGES && tab.cFree[tab.cI]>0)
+            got=allocRun(tab.cI,(CNF(end)==tab.cI) ? FNF(end) : tab.cHint[tab.cI],want,&f->resv);
+        if(got==0 && last!=NULL && tab.cFree[CNF(end)]>0)
+            got=allocRun(CNF(end),FNF(end),want,&f->resv);
+        for(c=0;got==0 && c<CART_MAX_CARTRIDGES;c++)
+            if(cartRoom(c)>0)
+                got=allocRun(c,tab.cHint[c],want,&f->resv);
+        for(c=0;got==0 && c<CART_MAX_CARTRIDGES;c++)//carts are full, take the runs other files hold
+            if(cartFormatted(c) && tab.cResv[c]>0)
+            {
+                allocSteal(c);
+                got=allocRun(c,tab.cHint[c],want,&f->resv);
+            }
+        if(got==0)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @allocFrame no free frames left on the carts");
+            return(CART_CHAIN_END);
+        }
+        f->nResv=got;
+        tab.cResv[CNF(f->resv)]+=got;
+    }
+
+    f->nResv--;
+    tab.cResv[CNF(f->resv)]--;
+    return(f->resv++);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocRun
+// Description  : takes a run of free frames in a cart, starting at the first
+//                free frame at or after from and wrapping around (next fit,
+//                callers pass the cart's hint or the file's last frame). Full
+//                words of the free map are skipped 32 frames at a time. The
+//                cart is formatted first if this is its first run
+//
+// Inputs       : cart - the cart
+//                from - frame to start looking at
+//                want - most frames to take
+//                first - gets cart*1024+frame of the run's first frame
+// Outputs      : frames taken, 0 if the cart is full
+//
+uint16_t allocRun(uint16_t cart, uint16_t from, uint16_t want, uint16_t* first)
+{
+    uint32_t* map=tab.freeMap[cart];
+    uint16_t i, fr, got=0;
+
+    if(!cartFormatted(cart) && formatCart(cart)==-1)
+        return(0);
+
+    for(i=0;i<CART_CARTRIDGE_SIZE;i++)
+    {
+        fr=(from+i)%CART_CARTRIDGE_SIZE;
+        if(fr%32==0 && map[fr/32]==0xffffffffu && i+32<=CART_CARTRIDGE_SIZE)
+        {
+            i+=31;//whole word taken
+            continue;
+        }
+        if(!(map[fr/32] & (1u<<(fr%32))))
+            break;
+    }
+    if(i>=CART_CARTRIDGE_SIZE)
+        return(0);
+
+    *first=cart*1024+fr;
+    while(got<want && fr<CART_CARTRIDGE_SIZE && !(map[fr/32] & (1u<<(fr%32))))
+    {
+        map[fr/32]|=1u<<(fr%32);
+        fr++;
+        got++;
+    }
+    tab.cFree[cart]-=got;
+    tab.cHint[cart]=fr%CART_CARTRIDGE_SIZE;
+    return(got);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocRelease
+// Description  : gives the unused part of a file's run back to its cart,
+//                when the file's last descriptor closes
+//
+// Inputs       : ino - the file's inode
+// Outputs      : none
+//
+void allocRelease(int32_t ino)
+{
+    struct Inode* f=&inodes[ino];
+
+    for(;f->nResv>0;f->nResv--,f->resv++)
+    {
+        tab.freeMap[CNF(f->resv)][FNF(f->resv)/32]&=~(1u<<(FNF(f->resv)%32));
+        tab.cFree[CNF(f->resv)]++;
+        tab.cResv[CNF(f->resv)]--;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocMark
+// Description  : takes one frame out of its cart's free map, for frames a
+//                mount finds in use
+//
+// Inputs       : file_num - cart*1024+frame
+// Outputs      : none
+//
+void allocMark(uint16_t file_num)
+{
+    if(tab.freeMap[CNF(file_num)][FNF(file_num)/32] & (1u<<(FNF(file_num)%32)))
+        return;
+    tab.freeMap[CNF(file_num)][FNF(file_num)/32]|=1u<<(FNF(file_num)%32);
+    tab.cFree[CNF(file_num)]--;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frameFree
+// Description  : gives a frame of a deleted or truncated file back to its
+//                cart. A write of it still queued and its copy in the cache
+//                are thrown away, nothing reads the frame again
+//
+// Inputs       : file_num - cart*1024+frame
+// Outputs      : none
+//
+void frameFree(uint16_t file_num)
+{
+    uint16_t cart=CNF(file_num), frame=FNF(file_num);
+
+    ioqCancel(file_num);
+    delete_cart_cache(cart,frame);
+
+    if(tab.cart[cart].fUsed[frame]==1023)
+        tab.cUsed[cart]--;
+    tab.cart[cart].fUsed[frame]=0;
+    tab.cart[cart].next[frame]=CART_CHAIN_END;
+    if(tab.freeMap[cart][frame/32] & (1u<<(frame%32)))
+    {
+        tab.freeMap[cart][frame/32]&=~(1u<<(frame%32));
+        tab.cFree[cart]++;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocSteal
+// Description  : takes back the unused runs other files hold in a cart once
+//                the cart is full, so it fills up before files spill to
+//                another cart
+//
+// Inputs       : cart - the full cart
+// Outputs      : none
+//
+void allocSteal(uint16_t cart)
+{
+    int32_t i;
+
+    for(i=0;i<capInodes;i++)
+        if(inodes[i].used==0 && inodes[i].nResv>0 && CNF(inodes[i].resv)==cart)
+            allocRelease(i);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : powerOff
@@ -354,6 +881,385 @@ int powerOff()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaSave
+// Description  : writes a checkpoint of the directories, files and their
+//                frames to free frames, then the superblock pointing at it.
+//                The frames of the checkpoint before it are freed after
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int metaSave()
+{
+    struct MetaBuf mb={NULL,0,0};
+    struct MetaSuper sb;
+    struct Inode* f;
+    char frame[CART_FRAME_SIZE];
+    uint32_t count=0, frames, i, at;
+    uint16_t c, got, first;
+    int32_t n;
+    uint8_t dir, len;
+
+    //STEP 1:: records, walking the namespace so each directory comes before what is in it
+    memset(&sb,0,sizeof(sb));
+    metaPut(&mb,&count,sizeof(count));
+    n=names.e[NAME_ROOT].child;
+    while(n!=NAME_NIL)
+    {
+        dir=names.e[n].dir;
+        len=strlen(names.e[n].path);
+        if(metaPut(&mb,&dir,1)==-1 || metaPut(&mb,&len,1)==-1 || metaPut(&mb,names.e[n].path,len)==-1)
+            goto fail;
+        if(!dir)
+        {
+            f=&inodes[names.e[n].file];
+            if(metaPut(&mb,&f->length,sizeof(f->length))==-1 || metaPut(&mb,&f->nExt,sizeof(f->nExt))==-1)
+                goto fail;
+            for(i=0;i<f->nExt;i++)
+                if(metaPut(&mb,&f->ext[i].file_num,sizeof(uint16_t))==-1 || metaPut(&mb,&f->ext[i].length,sizeof(uint16_t))==-1)
+                    goto fail;
+        }
+        count++;
+
+        if(dir && names.e[n].child!=NAME_NIL)
+            n=names.e[n].child;
+        else
+        {
+            while(n!=NAME_ROOT && names.e[n].next==NAME_NIL)
+                n=names.e[n].parent;
+            n=(n==NAME_ROOT) ? NAME_NIL : names.e[n].next;
+        }
+    }
+    memcpy(mb.b,&count,sizeof(count));
+
+    //STEP 2:: frames for it, the superblock's cart has to be formatted to hold the superblock
+    if(!cartFormatted(CNF(META_SUPER)) && formatCart(CNF(META_SUPER))==-1)
+        goto fail;
+    frames=(mb.len+CART_FRAME_SIZE-1)/CART_FRAME_SIZE;
+    for(i=0;i<frames;i+=got)
+    {
+        got=0;
+        if(tab.cI<CART_MAX_CARTRIDGES && cartRoom(tab.cI)>0)
+            got=allocRun(tab.cI,tab.cHint[tab.cI],frames-i,&first);
+        for(c=0;got==0 && c<CART_MAX_CARTRIDGES;c++)
+            if(cartRoom(c)>0)
+                got=allocRun(c,tab.cHint[c],frames-i,&first);
+        if(got==0 || sb.nRuns==META_MAX_RUNS)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @metaSave no room for a %u byte checkpoint",mb.len);
+            goto fail;
+        }
+        sb.runs[sb.nRuns].file_num=first;
+        sb.runs[sb.nRuns].length=got;
+        sb.nRuns++;
+    }
+
+    //STEP 3:: the checkpoint, then the superblock
+    at=0;
+    for(i=0;i<sb.nRuns;i++)
+        for(c=0;c<sb.runs[i].length;c++,at+=CART_FRAME_SIZE)
+        {
+            memset(frame,0,CART_FRAME_SIZE);
+            memcpy(frame,mb.b+at,(mb.len-at<CART_FRAME_SIZE) ? mb.len-at : CART_FRAME_SIZE);
+            if(writeFrame(sb.runs[i].file_num+c,frame)==-1)
+                goto fail;
+        }
+
+    sb.magic=META_MAGIC;
+    sb.version=META_VERSION;
+    sb.generation=meta.generation+1;
+    sb.bytes=mb.len;
+    sb.sum=metaSum(mb.b,mb.len);
+    memcpy(sb.formatted,tab.formatted,sizeof(sb.formatted));
+    sb.superSum=metaSum((uint8_t*)&sb,sizeof(sb));
+    memset(frame,0,CART_FRAME_SIZE);
+    memcpy(frame,&sb,sizeof(sb));
+    if(writeFrame(META_SUPER,frame)==-1)
+        goto fail;
+
+    //STEP 4:: the last checkpoint's frames are free now
+    metaFree(&meta);
+    meta=sb;
+    free(mb.b);
+    logMessage(LOG_INFO_LEVEL,"CART driver: checkpoint %u written, %u entries in %u bytes",sb.generation,count,mb.len);
+    return(0);
+
+fail:
+    metaFree(&sb);//the frames taken for it, the checkpoint before it stays
+    free(mb.b);
+    logMessage(LOG_ERROR_LEVEL,"Error @metaSave checkpoint not written");
+    return(-1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaLoad
+// Description  : mounts the carts, reading the superblock and the checkpoint
+//                it points at and building the namespace, files and cart
+//                tables back from it. Carts without a superblock are new
+//
+// Inputs       : none
+// Outputs      : 1 if mounted, 0 if there was nothing to mount, -1 if failure
+int metaLoad()
+{
+    char frame[CART_FRAME_SIZE];
+    struct MetaSuper sb;
+    uint8_t* b;
+    uint8_t dir, len;
+    char path[CART_MAX_PATH_LENGTH];
+    uint32_t count, r, i, at=0, length, nRuns, index, frames=0, sum;
+    uint16_t c, fn, prev, len2;
+    struct MetaRun run;
+    int32_t ino;
+
+    memset(&meta,0,sizeof(meta));
+    if(readFrame(META_SUPER,frame)==-1)
+        return(-1);
+    memcpy(&sb,frame,sizeof(sb));
+    if(sb.magic!=META_MAGIC || sb.version!=META_VERSION || sb.nRuns==0 || sb.nRuns>META_MAX_RUNS)
+        return(0);
+    sum=sb.superSum;
+    sb.superSum=0;
+    if(metaSum((uint8_t*)&sb,sizeof(sb))!=sum)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @metaLoad superblock is damaged, not mounting");
+        return(0);
+    }
+    sb.superSum=sum;
+
+    //STEP 1:: the runs have to stay in their carts and hold exactly the checkpoint
+    for(r=0;r<sb.nRuns;r++)
+    {
+        if(!metaRunOk(&sb.runs[r]))
+            break;
+        frames+=sb.runs[r].length;
+    }
+    if(r<sb.nRuns || frames!=(sb.bytes+(uint64_t)CART_FRAME_SIZE-1)/CART_FRAME_SIZE)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @metaLoad checkpoint %u runs do not match its %u bytes, not mounting",sb.generation,sb.bytes);
+        return(0);
+    }
+
+    //STEP 2:: read the checkpoint in, a batch of each run at a time
+    b=malloc((size_t)frames*CART_FRAME_SIZE);
+    if(b==NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @metaLoad out of memory");
+        return(-1);
+    }
+    for(r=0;r<sb.nRuns;r++)
+        for(c=0;c<sb.runs[r].length;c+=len2,at+=len2*CART_FRAME_SIZE)
+        {
+            len2=sb.runs[r].length-c;
+            if(len2>BUS_BATCH)
+                len2=BUS_BATCH;
+            if(readRun(sb.runs[r].file_num+c,len2,b+at)==-1)
+            {
+                busReap();
+                free(b);
+                return(-1);
+            }
+        }
+    if(busReap()==-1)
+    {
+        free(b);
+        return(-1);
+    }
+    if(metaSum(b,sb.bytes)!=sb.sum)
+    {
+        free(b);
+        logMessage(LOG_ERROR_LEVEL,"Error @metaLoad checkpoint %u is damaged, not mounting",sb.generation);
+        return(0);
+    }
+
+    //STEP 3:: the carts that were in use, with the checkpoint's own frames taken
+    memcpy(tab.formatted,sb.formatted,sizeof(tab.formatted));
+    for(c=0;c<CART_MAX_CARTRIDGES;c++)
+        if(cartFormatted(c))
+            resetCart(c);
+    for(r=0;r<sb.nRuns;r++)
+        for(c=0;c<sb.runs[r].length;c++)
+            allocMark(sb.runs[r].file_num+c);
+
+    //STEP 4:: directories and files, chains rebuilt from each file's runs
+    at=0;
+    if(metaTake(b,sb.bytes,&at,&count,sizeof(count))==-1)
+        goto bad;
+    for(i=0;i<count;i++)
+    {
+        memset(path,0,sizeof(path));
+        if(metaTake(b,sb.bytes,&at,&dir,1)==-1 || metaTake(b,sb.bytes,&at,&len,1)==-1 ||
+           len>=CART_MAX_PATH_LENGTH || metaTake(b,sb.bytes,&at,path,len)==-1)
+            goto bad;
+        if(dir)
+        {
+            if(nameAdd(path,1,-1)==NAME_NIL)
+                goto bad;
+            continue;
+        }
+
+        if(metaTake(b,sb.bytes,&at,&length,sizeof(length))==-1 || metaTake(b,sb.bytes,&at,&nRuns,sizeof(nRuns))==-1)
+            goto bad;
+        ino=inodeAlloc();
+        if(ino==-1)
+            goto bad;
+        inodes[ino].name=nameAdd(path,0,ino);
+        if(inodes[ino].name==NAME_NIL)
+            goto bad;
+        inodes[ino].length=length;
+
+        index=0;
+        prev=CART_CHAIN_END;
+        for(r=0;r<nRuns;r++)
+        {
+            if(metaTake(b,sb.bytes,&at,&run,sizeof(run))==-1 || !metaRunOk(&run))
+                goto bad;
+            for(c=0;c<run.length;c++,index++)
+            {
+                fn=run.file_num+c;
+                if(extAppend(ino,fn)==-1)
+                    goto bad;
+                allocMark(fn);
+                if(prev==CART_CHAIN_END)
+                    inodes[ino].start=fn;
+                else
+                    tab.cart[CNF(prev)].next[FNF(prev)]=fn;
+                if(length>=(index+1)*CART_FRAME_SIZE)
+                {
+                    tab.cart[CNF(fn)].fUsed[FNF(fn)]=1023;
+                    tab.cUsed[CNF(fn)]++;
+                }
+                else if(length>index*CART_FRAME_SIZE)
+                    tab.cart[CNF(fn)].fUsed[FNF(fn)]=length-index*CART_FRAME_SIZE;
+                prev=fn;
+            }
+        }
+        if(prev==CART_CHAIN_END)
+            goto bad;
+    }
+
+    meta=sb;
+    free(b);
+    logMessage(LOG_INFO_LEVEL,"CART driver: mounted checkpoint %u, %u entries",sb.generation,count);
+    return(1);
+
+bad:
+    free(b);
+    logMessage(LOG_ERROR_LEVEL,"Error @metaLoad checkpoint %u does not parse",sb.generation);
+    return(-1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaRunOk
+// Description  : checks a run read off the carts stays inside one cart
+//
+// Inputs       : run - the run
+// Outputs      : 1 if it does, 0 if not
+int metaRunOk(const struct MetaRun* run)
+{
+    return( run->length>0 && run->length<=CART_CARTRIDGE_SIZE &&
+            FNF(run->file_num)+run->length<=CART_CARTRIDGE_SIZE );
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaFree
+// Description  : gives the frames a checkpoint is in back to their carts
+//
+// Inputs       : sb - the superblock of the checkpoint
+// Outputs      : none
+void metaFree(const struct MetaSuper* sb)
+{
+    uint32_t i;
+    uint16_t c, fn;
+
+    for(i=0;i<sb->nRuns;i++)
+        for(c=0;c<sb->runs[i].length;c++)
+        {
+            fn=sb->runs[i].file_num+c;
+            tab.freeMap[CNF(fn)][FNF(fn)/32]&=~(1u<<(FNF(fn)%32));
+            tab.cFree[CNF(fn)]++;
+        }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaPut
+// Description  : adds bytes to the end of a checkpoint being built
+//
+// Inputs       : mb - the checkpoint
+//                data - the bytes
+//                n - how many
+// Outputs      : 0 if successful, -1 if failure
+int metaPut(struct MetaBuf* mb, const void* data, uint32_t n)
+{
+    uint8_t* grown;
+    uint32_t cap=(mb->cap>0) ? mb->cap : CART_FRAME_SIZE;
+
+    while(mb->len+n>cap)
+        cap*=2;
+    if(cap!=mb->cap)
+    {
+        grown=realloc(mb->b,cap);
+        if(grown==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @metaPut out of memory");
+            return(-1);
+        }
+        mb->b=grown;
+        mb->cap=cap;
+    }
+    memcpy(mb->b+mb->len,data,n);
+    mb->len+=n;
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaTake
+// Description  : takes the next bytes of a checkpoint being read
+//
+// Inputs       : b - the checkpoint
+//                bytes - its length
+//                at - where the next bytes are, moved past them
+//                out - where to copy them
+//                n - how many
+// Outputs      : 0 if successful, -1 if the checkpoint is too short
+int metaTake(const uint8_t* b, uint32_t bytes, uint32_t* at, void* out, uint32_t n)
+{
+    if(*at+n>bytes)
+        return(-1);
+    memcpy(out,b+*at,n);
+    *at+=n;
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaSum
+// Description  : FNV-1a of a checkpoint, to tell a whole one from a torn one
+//
+// Inputs       : b - the bytes
+//                n - how many
+// Outputs      : the sum
+uint32_t metaSum(const uint8_t* b, uint32_t n)
+{
+    uint32_t h=2166136261u, i;
+
+    for(i=0;i<n;i++)
+        h=(h^b[i])*16777619u;
+    return(h);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_poweron
@@ -374,42 +1280,31 @@ int32_t cart_poweron(void) {
     initCache();
 
 
-    uint16_t c;
     tab.cI=-1;
+    tab.loads=0;
+    ioqInit();
 
-    // zero the memory  use  CART_OP_BZERO
-    for( c=0; c < CART_MAX_CARTRIDGES; c++)
-    {
-        if(loadCart(c)!=0)
-        {   
-            close_cart_cache();
-            logMessage(LOG_ERROR_LEVEL,"Error rRT1 is not 0 @ ld Cart");
-            return(-1);
-        }
-
-       if(zeroCart()!=0)
-        {   
-            close_cart_cache();
-            logMessage(LOG_ERROR_LEVEL,"Error rRT1 is not 0 @ zero cart");
-            return(-1);
-        }
-    }    
+    // carts are zeroed with CART_OP_BZERO when the first frame is taken from them
+    memset(tab.formatted,0,sizeof(tab.formatted));
 
     //STEP 4:: set up the data structure
     tab.flag=1;// flag that the power is on
     // tab.cache_flag=0;
-    tab.new=0;
-    loadCart(0);   
     
-    for(c=0;c<CART_MAX_TOTAL_FILES;c++)
-    {        
-        myFiles[c].used=-1;    
-        myFiles[c].start=0;    
-        myFiles[c].file_num=0;    
-        myFiles[c].file_pos=0;    
-        myFiles[c].length=0;     
-        myFiles[c].offset=0;
-    }
+	freeFiles();//the inode and descriptor tables grow as files are opened
+	if(initNames()==-1)
+		return(-1);
+
+	//STEP 5:: mount what the carts already hold
+	if(metaLoad()==-1)
+	{
+		logMessage(LOG_ERROR_LEVEL,"Error @cart_poweron mount failed");
+		return(-1);
+	}
+
+	//STEP 6:: the I/O thread for cart_aio_read/cart_aio_write
+	if(aioStart()==-1)
+		return(-1);
 	// Return successfully
 	return(0);
 }
@@ -433,6 +1328,7 @@ int32_t cart_poweroff(void)
     }
     
     //STEP 2:: Clean up Data structure
+    aioStop();//the requests still in the ring finish first
     if(tab.cache_flag==1)// cache on
         if(close_cart_cache()==-1)
         {   
@@ -440,11 +1336,23 @@ int32_t cart_poweroff(void)
             logMessage(LOG_ERROR_LEVEL,"Error @ cache close ");
             return(-1);
         }
+    if(ioqDrain()==-1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @ poweroff queued writes failed");
+        return(-1);
+    }
+    if(metaSave()==-1)
+        return(-1);
 
     //STEP 3:: Close all files
     int i;
-    for(i=0;i<CART_MAX_TOTAL_FILES;i++)
-       myFiles[i].used=0;
+    for(i=0;i<capFiles;i++)
+       if(myFiles[i].used==1)
+           raReport(i);
+    freeFiles();
+    freeNames();
+    logMessage(LOG_INFO_LEVEL,"CART driver: %u cartridge loads, %u frame writes queued (%u merged), %u frames written",
+        tab.loads,ioq.queued,ioq.merged,ioq.sent);
 
     //STEP 4:: Power off memory system
     powerOff();
@@ -458,387 +1366,2721 @@ int32_t cart_poweroff(void)
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : findFile
-// Description  : Helper function for cart_open, finds the file handle from the path
+// Description  : Helper function for cart_open, finds the inode from the path
 //
 // Inputs       : path - filename of the file to open
-// Outputs      : file handle or -1 if no exist
-int16_t findFile(char* path)
+// Outputs      : inode or -1 if no exist
+int32_t findFile(char* path)
 { 
-    int16_t x;
-    for(x=0;x<CART_MAX_TOTAL_FILES;x++)
-    { 
-        if((myFiles[x].used > -1) && (strncmp(myFiles[x].path,path,128)==0))
-            return x;
-    } 
-    return -1;
+    int32_t n=nameFind(path);
+
+    if(n==NAME_NIL || names.e[n].dir)
+        return -1;
+    return names.e[n].file;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_open
-// Description  : This function opens the file and returns a file handle
+// Function     : freeFiles
+// Description  : empties the inode and descriptor tables, at power on and off
 //
-// Inputs       : path - filename of the file to open
-// Outputs      : file handle if successful, -1 if failure
+// Inputs       : none
+// Outputs      : none
+void freeFiles()
+{
+    int32_t i;
+
+    for(i=0;i<capInodes;i++)
+        free(inodes[i].ext);
+    free(inodes);
+    free(myFiles);
+    inodes=NULL;
+    myFiles=NULL;
+    capInodes=capFiles=0;
+    freeInode=freeFile=-1;
+}
 
-int16_t cart_open(char *path) {
-    
-    int16_t f=findFile(path); //f= file handle
 
-    //STEP 1:: search to see if file exists
-     if(f>-1)
-     {
-          //STEP 2:: check if file is open 
-        if(myFiles[f].used==1)//file already open
-        {        
-            close_cart_cache();
-            logMessage(LOG_ERROR_LEVEL,"Error file already open @cart_open");
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : inodeAlloc
+// Description  : takes a free inode, doubling the table when there is none
+//
+// Inputs       : none
+// Outputs      : the inode or -1 if failure
+int32_t inodeAlloc()
+{
+    struct Inode* grown;
+    int32_t i, cap=(capInodes>0) ? 2*capInodes : FILE_INIT_SIZE;
+
+    if(freeInode==-1)
+    {
+        grown=realloc(inodes,sizeof(struct Inode)*cap);
+        if(grown==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @inodeAlloc out of memory");
             return(-1);
         }
-        else
+        inodes=grown;
+        for(i=cap-1;i>=capInodes;i--)
         {
-            //file is closed and exists f= the file#
-            myFiles[f].used=1;
-            myFiles[f].file_num = myFiles[f].start;
-                   // myFiles[f].file_pos = myFiles[f].start_pos;
-            return(f); //return file handle
+            memset(&inodes[i],0,sizeof(struct Inode));
+            inodes[i].used=-1;
+            inodes[i].nextFree=freeInode;
+            freeInode=i;
         }
+        capInodes=cap;
     }
-    else 
-    if(f==-1)//file does not exist so create
+
+    i=freeInode;
+    freeInode=inodes[i].nextFree;
+    inodes[i].used=0;
+    inodes[i].opens=0;
+    inodes[i].length=0;
+    inodes[i].nExt=0;
+    inodes[i].nResv=0;
+    return(i);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : inodeFree
+// Description  : gives an inode back, its extent map is kept for the next file
+//
+// Inputs       : ino - the inode
+// Outputs      : none
+void inodeFree(int32_t ino)
+{
+    inodes[ino].used=-1;
+    inodes[ino].nExt=0;
+    inodes[ino].nextFree=freeInode;
+    freeInode=ino;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fileAlloc
+// Description  : takes a free descriptor, doubling the table when there is
+//                none, up to FILE_MAX_FDS
+//
+// Inputs       : none
+// Outputs      : the file handle or -1 if failure
+int32_t fileAlloc()
+{
+    struct Filer* grown;
+    int32_t i, cap=(capFiles>0) ? 2*capFiles : FILE_INIT_SIZE;
+
+    if(freeFile==-1)
     {
-        f++;//f now is 0
-        while(myFiles[f].used!=-1)
-            f++;// find first unused file struct
-        
-        strncpy(myFiles[f].path,path,128);//copy path to Filer.path
-        myFiles[f].used=1;   // set used to open
-        myFiles[f].start=tab.new; 
-        tab.new++; //set the start loc to last write
-        myFiles[f].file_num = myFiles[f].start; //set curr write num to the start
-        myFiles[f].file_pos = 0;//set the curr write pos to the start pos
-        myFiles[f].length = 0;// set the length of the file to 0
-        return(f);//return file handle
+        if(capFiles>=FILE_MAX_FDS)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @fileAlloc all %d file handles are open",FILE_MAX_FDS);
+            return(-1);
+        }
+        grown=realloc(myFiles,sizeof(struct Filer)*cap);
+        if(grown==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @fileAlloc out of memory");
+            return(-1);
+        }
+        myFiles=grown;
+        for(i=cap-1;i>=capFiles;i--)
+        {
+            memset(&myFiles[i],0,sizeof(struct Filer));
+            myFiles[i].used=-1;
+            myFiles[i].nextFree=freeFile;
+            freeFile=i;
+        }
+        capFiles=cap;
     }
 
-    return (-1);
+    i=freeFile;
+    freeFile=myFiles[i].nextFree;
+    return(i);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_close
-// Description  : This function closes the file
-//
-// Inputs       : fd - the file descriptor
+// Function     : initNames
+// Description  : sets up an empty namespace holding just the top directory
 //
+// Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
-//
-int16_t cart_close(int16_t fd) {
+int initNames()
+{
+    int32_t i;
 
-    //STEP 1:: check if legit file handle
-    if((fd>4||fd<0) ||myFiles[fd].used==-1)
-    {       
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_close bad file handle");
-    	return (-1);
-    }    
-    //STEP 2:: check if file is open
-    if(myFiles[fd].used==0)//used==0 means it is closed
-    {       
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_close file already closed");
-      	return (-1);
+    freeNames();
+    names.e=malloc(sizeof(struct Name)*NAME_INIT_SIZE);
+    names.table=malloc(sizeof(int32_t)*NAME_INIT_SIZE);
+    if(names.e==NULL || names.table==NULL)
+    {
+        freeNames();
+        logMessage(LOG_ERROR_LEVEL,"Error @initNames out of memory");
+        return(-1);
     }
-    //STEP 3:: set flag to close position
-    if(myFiles[fd].used==1) // used==1 means it is closed
-        myFiles[fd].used=0;
-    
-	// Return successfully
-	return (0);
+    names.cap=NAME_INIT_SIZE;
+    names.mask=NAME_INIT_SIZE-1;
+    for(i=0;i<NAME_INIT_SIZE;i++)
+    {
+        names.table[i]=NAME_NIL;
+        names.e[i].next=(i+1<NAME_INIT_SIZE) ? i+1 : NAME_NIL;
+    }
+    names.freeName=0;
+    names.count=0;
+
+    //the top directory, its path is empty
+    nameAdd("",1,-1);
+    return(0);
 }
 
 
-int32_t reader(uint16_t cart, uint16_t frame, void* buf)
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeNames
+// Description  : throws the namespace away, at power off
+//
+// Inputs       : none
+// Outputs      : none
+void freeNames()
 {
+    free(names.e);
+    free(names.table);
+    memset(&names,0,sizeof(names));
+}
 
-    loadCart(cart);//check that cartridge is good and sets cI
- 
 
-     
-    void* t_buf=NULL;  
-        t_buf=get_cart_cache(cart*1024+frame);   
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cleanPath
+// Description  : the path as the namespace keeps it, without leading /'s
+//
+// Inputs       : path - the path given to the interface
+// Outputs      : pointer into path
+const char* cleanPath(const char* path)
+{
+    while(*path=='/')
+        path++;
+    return(path);
+}
 
-    if(t_buf!=NULL)
-    {   
-        memcpy(buf,t_buf,1024);
-        return(0); //CACHE HIT!!!
-    }
 
-    if(tab.cart[tab.cI].fUsed[frame]==0)
-        return (0);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nameHash
+// Description  : FNV-1a hash of a path
+//
+// Inputs       : path - the (clean) path
+// Outputs      : the hash
+uint32_t nameHash(const char* path)
+{
+    uint32_t h=2166136261u;
+    int i;
 
-    //else cache miss :(
-    sReg= stitch(CART_OP_RDFRME,0,0,0,frame);
-    //rReg= cart_io_bus(sReg,buf);
-    rReg=cart_client_bus_request(sReg, buf);
-     
-    if( unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1))
-    {       
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error in readFrame in write frame"); 
-        return(-1);
-    }
-    if(rRT1!=0)
-    {       
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @readframe in write frame");
-        return(-1);
-    }
-  
-    return(0);
+    for(i=0;i<CART_MAX_PATH_LENGTH && path[i]!='\0';i++)
+        h=(h^(uint8_t)path[i])*16777619u;
+    return(h);
 }
 
 
-int32_t writer(uint16_t cart, uint16_t frame, void* buf)
-{    //write myBuf to the frame
-    loadCart(cart);//check that cartridge is good and sets cI
-    sReg= stitch(CART_OP_WRFRME,0,0,0,frame);
-   // rReg= cart_io_bus(sReg,buf);
-    rReg=cart_client_bus_request(sReg, buf);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nameFind
+// Description  : looks a path up in the namespace
+//
+// Inputs       : path - the path of the file or directory
+// Outputs      : the namespace entry or NAME_NIL if there is none
+int32_t nameFind(const char* path)
+{
+    int32_t n;
 
-    if( unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1))
-    {       
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error in write writeFrame "); 
-        return(-1);
+    if(names.table==NULL)
+        return(NAME_NIL);
+
+    path=cleanPath(path);
+    n=names.table[nameHash(path) & names.mask];
+    while(n!=NAME_NIL && strncmp(names.e[n].path,path,CART_MAX_PATH_LENGTH)!=0)
+        n=names.e[n].hnext;
+    return(n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nameAdd
+// Description  : adds a file or directory to the namespace, in the directory
+//                named by its path up to the last /, which must exist. The
+//                entries and buckets double when they run out
+//
+// Inputs       : path - the path of the new entry
+//                dir - 1 for a directory, 0 for a file
+//                file - the inode of a file
+// Outputs      : the new namespace entry or NAME_NIL if failure
+int32_t nameAdd(const char* path, int8_t dir, int32_t file)
+{
+    char parentPath[CART_MAX_PATH_LENGTH];
+    const char* slash;
+    struct Name* grown;
+    int32_t* table;
+    int32_t n, parent=NAME_NIL, i;
+    uint32_t b;
+
+    path=cleanPath(path);
+    if(strlen(path)+dir>=CART_MAX_PATH_LENGTH || nameFind(path)!=NAME_NIL)
+        return(NAME_NIL);//a directory's name is listed with a / after it
+
+    //the directory it goes in, the top one has no parent
+    if(names.count>0)
+    {
+        slash=strrchr(path,'/');
+        if(path[0]=='\0' || (slash!=NULL && slash[1]=='\0'))
+            return(NAME_NIL);
+        memset(parentPath,0,sizeof(parentPath));
+        if(slash!=NULL)
+            strncpy(parentPath,path,slash-path);
+        parent=nameFind(parentPath);
+        if(parent==NAME_NIL || !names.e[parent].dir)
+            return(NAME_NIL);
     }
-    if(rRT1!=0)
-    { 
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @ writeframe");
-        return(-1);
+
+    if(names.freeName==NAME_NIL)//out of entries, double them
+    {
+        grown=realloc(names.e,sizeof(struct Name)*2*names.cap);
+        if(grown==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @nameAdd out of memory");
+            return(NAME_NIL);
+        }
+        names.e=grown;
+        for(i=names.cap;i<2*names.cap;i++)
+            names.e[i].next=(i+1<2*names.cap) ? i+1 : NAME_NIL;
+        names.freeName=names.cap;
+        names.cap*=2;
     }
 
-        if(put_cart_cache(cart*1024+frame, buf)==-1)
-        {    
-            close_cart_cache();
-            logMessage(LOG_ERROR_LEVEL,"Errror @ cache put");
-            return(-1);
+    if((uint32_t)names.count>names.mask)//more entries than buckets, rehash into twice the buckets
+    {
+        table=malloc(sizeof(int32_t)*2*(names.mask+1));
+        if(table==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @nameAdd out of memory");
+            return(NAME_NIL);
         }
+        for(b=0;b<2*(names.mask+1);b++)
+            table[b]=NAME_NIL;
+        for(b=0;b<=names.mask;b++)
+            while((n=names.table[b])!=NAME_NIL)
+            {
+                names.table[b]=names.e[n].hnext;
+                names.e[n].hnext=table[nameHash(names.e[n].path) & (2*names.mask+1)];
+                table[nameHash(names.e[n].path) & (2*names.mask+1)]=n;
+            }
+        free(names.table);
+        names.table=table;
+        names.mask=2*names.mask+1;
+    }
 
-    return(0);
+    n=names.freeName;
+    names.freeName=names.e[n].next;
+    names.count++;
+
+    memset(names.e[n].path,0,CART_MAX_PATH_LENGTH);
+    strncpy(names.e[n].path,path,CART_MAX_PATH_LENGTH-1);
+    names.e[n].dir=dir;
+    names.e[n].file=file;
+    names.e[n].parent=parent;
+    names.e[n].child=NAME_NIL;
+
+    //hash bucket, then the front of its directory
+    b=nameHash(path) & names.mask;
+    names.e[n].hnext=names.table[b];
+    names.table[b]=n;
+    names.e[n].prev=NAME_NIL;
+    names.e[n].next=NAME_NIL;
+    if(parent!=NAME_NIL)
+    {
+        names.e[n].next=names.e[parent].child;
+        if(names.e[parent].child!=NAME_NIL)
+            names.e[names.e[parent].child].prev=n;
+        names.e[parent].child=n;
+    }
+    return(n);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_read
-// Description  : Reads "count" bytes from the file handle "fh" into the 
-//                buffer "buf"
-//
-// Inputs       : fd - filename of the file to read from
-//                buf - pointer to buffer to read into
-//                count - number of bytes to read
-// Outputs      : bytes read if successful, -1 if failure
+// Function     : nameRemove
+// Description  : takes an entry out of the namespace and its directory
 //
-int32_t cart_read(int16_t fd, void *buf, int32_t count) {
+// Inputs       : n - the namespace entry
+// Outputs      : none
+void nameRemove(int32_t n)
+{
+    int32_t* link=&names.table[nameHash(names.e[n].path) & names.mask];
 
-    //STEP 1:: check if file is open 
-    if(myFiles[fd].used==0)
-    {       
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_read bad file handle, file is closed");
-        return (-1);
-    }    
-    
-    //STEP 2:: Check if file handle is legit 
-    if(myFiles[fd].used==-1)
-    {   
-        close_cart_cache();    
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_read bad file handle, file no exist");
-        return (-1);
-    }    
-    
-    //STEP 3:: find memory position           
-    char tbuf[count];
-    char tempBuf[1024];
-    int32_t read=0;  
-    int i=myFiles[fd].file_pos;     
+    while(*link!=n)
+        link=&names.e[*link].hnext;
+    *link=names.e[n].hnext;
 
-    while(count+i>=1024)
-    {   
-      
-        reader(CNF(myFiles[fd].file_num), FNF(myFiles[fd].file_num),tempBuf);
-        memcpy(&tbuf[read],&tempBuf[i],1024-i);//copy the next frame to my buf
-        myFiles[fd].file_num= tab.cart[tab.cI].next[FNF(myFiles[fd].file_num)];
-        myFiles[fd].file_pos=0;
-        read=  read+1024-i;
-        count= count-1024+i;
-        i=0;
-    } 
-    if( count+i < 1024 ) //second case      // u end in the middle count
-    {   
-        //myBuf is the starting value of the read
-        reader(CNF(myFiles[fd].file_num) , FNF(myFiles[fd].file_num), tempBuf);
-      
-        memcpy(&tbuf[read], &tempBuf[i] ,count);
-        myFiles[fd].file_pos= i+count;
-        read+= count;  
-    }//exit and return read
+    if(names.e[n].prev!=NAME_NIL)
+        names.e[names.e[n].prev].next=names.e[n].next;
+    else
+        names.e[names.e[n].parent].child=names.e[n].next;
+    if(names.e[n].next!=NAME_NIL)
+        names.e[names.e[n].next].prev=names.e[n].prev;
 
-    memcpy(buf,tbuf,read);
-	return (read);
+    names.e[n].next=names.freeName;
+    names.freeName=n;
+    names.count--;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
-//                buffer  "buf"
-//
-// Inputs       : fd - filename of the file to write to
-//                buf - pointer to buffer to write from
-//                count - number of bytes to write
-// Outputs      : bytes written if successful, -1 if failure
+// Function     : cart_mkdir
+// Description  : makes a directory, the directory it goes in must exist
 //
-int32_t cart_write(int16_t fd, void *buf, int32_t count) 
+// Inputs       : path - path of the new directory
+// Outputs      : 0 if successful, -1 if failure
+int32_t cart_mkdir(char *path)
 {
-    if(myFiles[fd].used==0)
+    aioDrain();
+    if(nameFind(path)!=NAME_NIL)
     {
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_read bad file handle, file is closed");
-        return (-1);
-    }    
-    if(myFiles[fd].used==-1)
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_mkdir [%s] already exists",path);
+        return(-1);
+    }
+    if(nameAdd(path,1,-1)==NAME_NIL)
     {
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_read bad file handle, file no exist");
-        return (-1);
-    }//correct file handle      
-   
-    char tbuf[count];
-    memcpy(tbuf,buf,count);// move contents to a char array
-    char myBuf[1024];
-    int i=myFiles[fd].file_pos; // i =0 if new frame, or the file pos
-    int written=0;
-
-    reader(CNF(myFiles[fd].file_num), FNF(myFiles[fd].file_num),myBuf);
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_mkdir cannot make [%s]",path);
+        return(-1);
+    }
+    return(0);
+}
 
-    // first iteration, read the fram
-    while(count+i>=1024)//middle bulk
-    {     
-        if(tab.cart[CNF(myFiles[fd].file_num)].next[FNF(myFiles[fd].file_num)] == 65535 )
-            myFiles[fd].offset=0;
-        else
-            myFiles[fd].offset=1;
-       
-        memcpy(&myBuf[i],&tbuf[written],1024-i);
 
-        writer(CNF(myFiles[fd].file_num), FNF(myFiles[fd].file_num),myBuf);
-        //frame written and full, need to set next and fused and cUsed and length
-        
-        if(myFiles[fd].offset==0)//no offset update filing info
-        {
-            tab.cart[tab.cI].fUsed[FNF(myFiles[fd].file_num)]= 1023;        
-            tab.cart[tab.cI].next[FNF(myFiles[fd].file_num)]= tab.new;
-            tab.new++;
-            myFiles[fd].length+=1024-i;    
-            tab.cUsed[tab.cI]++; 
-            //myFiles[fd].offset=1; 
-        } 
-       
-        myFiles[fd].file_num= tab.cart[tab.cI].next[FNF(myFiles[fd].file_num)];
-        myFiles[fd].file_pos=0;
-        myFiles[fd].curr_len+=1024-i;
-        written+=(1024-i);    
-        count-=(1024-i);
-        i=0;//set i because all positions will be 0 until end
-        
-        //read in the next frame for the loop
-        reader(CNF(myFiles[fd].file_num), FNF(myFiles[fd].file_num),myBuf);
-    }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_readdir
+// Description  : lists a directory one entry per call
+//
+// Inputs       : path - path of the directory ("" or "/" for the top)
+//                cookie - 0 for the first call, then left as the last
+//                         call set it
+//                name - gets the name of the entry (CART_MAX_PATH_LENGTH
+//                       bytes), directories end in /
+// Outputs      : 1 if an entry was returned, 0 at the end, -1 if failure
+int32_t cart_readdir(char *path, int32_t *cookie, char *name)
+{
+    int32_t d=nameFind(path), n;
+    const char* base;
 
-       
-    if(count+i<1024)//last part
+    aioDrain();
+    if(d==NAME_NIL || !names.e[d].dir)
     {
-        if(myFiles[fd].length<(myFiles[fd].curr_len+i+count))
-            myFiles[fd].offset=0;
-        
-        memcpy(&myBuf[i],&tbuf[written],count);
-
-        //write myBuf to the frame
-        writer(CNF(myFiles[fd].file_num),FNF(myFiles[fd].file_num),myBuf);
-        myFiles[fd].curr_len+=count;
-        if(myFiles[fd].offset==0)
-        {//no offset
-            myFiles[fd].length+= myFiles[fd].curr_len;
-            tab.cart[tab.cI].fUsed[FNF(myFiles[fd].file_num)]= count+i;     
-        }  //else u r overwrighting and not using more memory
-          
-        written+= count;
-        myFiles[fd].file_pos+=count;
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_readdir [%s] is not a directory",path);
+        return(-1);
     }
 
-    return(written); 
+    //the cookie is the entry to return next, plus one (0 means start over)
+    n=(*cookie==0) ? names.e[d].child : *cookie-1;
+    if(n<0 || n>=names.cap || names.e[n].parent!=d)
+        return(0);
+
+    base=strrchr(names.e[n].path,'/');
+    base=(base!=NULL) ? base+1 : names.e[n].path;
+    if(snprintf(name,CART_MAX_PATH_LENGTH,"%s%s",base,(names.e[n].dir) ? "/" : "")>=CART_MAX_PATH_LENGTH)
+        return(-1);//nameAdd keeps every name short enough
+    *cookie=(names.e[n].next!=NAME_NIL) ? names.e[n].next+1 : -1;
+    return(1);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_delete
+// Description  : removes a closed file, its frames go back to the carts for
+//                new files
+//
+// Inputs       : path - path of the file
+// Outputs      : 0 if successful, -1 if failure
+int32_t cart_delete(char *path)
+{
+    int32_t n=nameFind(path), f;
+    uint32_t i, j;
+
+    aioDrain();
+    if(n==NAME_NIL || names.e[n].dir)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_delete [%s] is not a file",path);
+        return(-1);
+    }
+    f=names.e[n].file;
+    if(inodes[f].opens>0)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_delete [%s] is open",path);
+        return(-1);
+    }
+
+    allocRelease(f);
+    for(i=0;i<inodes[f].nExt;i++)
+        for(j=0;j<inodes[f].ext[i].length;j++)
+            frameFree(inodes[f].ext[i].file_num+j);
+
+    nameRemove(n);
+    inodeFree(f);//the inode can hold a new file
+    return(0);
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_seek
-// Description  : Seek to specific point in the file
+// Function     : cart_truncate
+// Description  : cuts a file down to length bytes, the frames past the new
+//                end go back to the carts. Descriptors past the end move to
+//                it. Files only shrink, writes make them longer
 //
-// Inputs       : fd - filename of the file to write to
-//                loc - offfset of file in relation to beginning of file
+// Inputs       : fd - file handle open on the file
+//                length - new length, at most the file's length
 // Outputs      : 0 if successful, -1 if failure
-int32_t cart_seek(int16_t fd, uint32_t loc) 
+int32_t cart_truncate(int16_t fd, uint32_t length)
 {
-    int i;
+    aioDrain();
+    if(fd<0 || fd>=capFiles || myFiles[fd].used!=1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_truncate bad file handle");
+        return(-1);
+    }
+    int32_t ino=myFiles[fd].inode, i;
+    struct Inode* node=&inodes[ino];
+    struct Extent* e;
+    uint32_t keep=length/CART_FRAME_SIZE+1;//a file ends in the frame its next write goes to
+    uint16_t last;
 
-    if(myFiles[fd].used==0)
+    if(length>node->length)
     {
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_seek bad file handle, file is closed");
-        return (-1);
-    }    
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_truncate length %u past the end %u",length,node->length);
+        return(-1);
+    }
 
-    if(myFiles[fd].used==-1)
+    //STEP 1:: free the frames past the new end, last extent first, and the run
+    //held for the file so it grows again right after its new last frame
+    allocRelease(ino);
+    while(node->nExt>0)
     {
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_seek bad file handle, file no exist");
-        return (-1);
-    }//correct file handle  
- 
-    //STEP 3:: check if position is in the file 
-    if(loc> myFiles[fd].length)
+        e=&node->ext[node->nExt-1];
+        if(e->first>=keep)
+        {
+            for(i=0;i<e->length;i++)
+                frameFree(e->file_num+i);
+            node->nExt--;
+            continue;
+        }
+        for(i=keep-e->first;i<e->length;i++)
+            frameFree(e->file_num+i);
+        if(e->first+e->length>keep)
+            e->length=keep-e->first;
+        break;
+    }
+
+    //STEP 2:: the new last frame ends the chain
+    last=extFind(ino,keep-1);
+    if(tab.cart[CNF(last)].fUsed[FNF(last)]==1023)
+        tab.cUsed[CNF(last)]--;
+    tab.cart[CNF(last)].fUsed[FNF(last)]=length%CART_FRAME_SIZE;
+    tab.cart[CNF(last)].next[FNF(last)]=CART_CHAIN_END;
+    if(keep>1)
     {
-        close_cart_cache();
-        logMessage(LOG_ERROR_LEVEL,"Error @cart_seek loc>length");
-        return (-1);
-    }       
+        last=extFind(ino,keep-2);//the frame before is full
+        if(tab.cart[CNF(last)].fUsed[FNF(last)]!=1023)
+            tab.cUsed[CNF(last)]++;
+        tab.cart[CNF(last)].fUsed[FNF(last)]=1023;
+    }
+    node->length=length;
 
+    //STEP 3:: descriptors past the end go to it
+    for(i=0;i<capFiles;i++)
+        if(myFiles[i].used==1 && myFiles[i].inode==ino && myFiles[i].curr_len>length)
+        {
+            myFiles[i].file_num=extFind(ino,length/CART_FRAME_SIZE);
+            myFiles[i].file_pos=length%CART_FRAME_SIZE;
+            myFiles[i].curr_len=length;
+            myFiles[i].ra_last=-1;
+            myFiles[i].ra_pending=0;
+            myFiles[i].ra_seq=0;
+        }
+    return(0);
+}
 
-   /* myFiles[fd].offset=1;//set the offset flag to on(1)
-    //STEP 4:: reset position
-    myFiles[fd].file_num= loc/1024;
-    myFiles[fd].file_pos= loc%1024;
-    */
-    if(loc==myFiles[fd].length)
-        myFiles[fd].offset=0;
-    else
-        myFiles[fd].offset=1;  
 
-    myFiles[fd].file_num= myFiles[fd].start;
-    
-    for(i=0; i<(loc/1024);i++)
-        myFiles[fd].file_num = tab.cart[CNF(myFiles[fd].file_num)].next[FNF(myFiles[fd].file_num)]; 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_rmdir
+// Description  : removes an empty directory
+//
+// Inputs       : path - path of the directory
+// Outputs      : 0 if successful, -1 if failure
+int32_t cart_rmdir(char *path)
+{
+    int32_t n=nameFind(path);
+
+    aioDrain();
+    if(n==NAME_NIL || n==NAME_ROOT || !names.e[n].dir || names.e[n].child!=NAME_NIL)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_rmdir [%s] is not an empty directory",path);
+        return(-1);
+    }
+
+    nameRemove(n);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_open
+// Description  : This function opens the file and returns a file handle
+//
+// Inputs       : path - filename of the file to open
+// Outputs      : file handle if successful, -1 if failure
+
+int16_t cart_open(char *path) {
     
-    myFiles[fd].curr_len=loc;
+    int32_t ino=findFile(path); //ino= the file's inode
+    int32_t f;
+
+    aioDrain();//async requests queued before this go first
+    //STEP 1:: search to see if file exists
+    if(ino==-1)//file does not exist so create
+    {
+        ino=inodeAlloc();
+        if(ino==-1)
+            return(-1);
+        inodes[ino].name=nameAdd(path,0,ino);
+        if(inodes[ino].name==NAME_NIL)
+        {
+            inodeFree(ino);
+            logMessage(LOG_ERROR_LEVEL,"Error @cart_open cannot create [%s], no such directory",path);
+            return(-1);
+        }
+        inodes[ino].start=allocFrame(ino);
+        if(inodes[ino].start==CART_CHAIN_END)
+        {
+            nameRemove(inodes[ino].name);
+            inodeFree(ino);
+            return(-1);
+        }
+        inodes[ino].length = 0;// set the length of the file to 0
+        if(extAppend(ino,inodes[ino].start)==-1)
+        {
+            frameFree(inodes[ino].start);
+            allocRelease(ino);
+            nameRemove(inodes[ino].name);
+            inodeFree(ino);
+            return(-1);
+        }
+    }
+
+    //STEP 2:: a new descriptor at the start of the file, the file can be open more than once
+    f=fileAlloc();
+    if(f==-1)
+        return(-1);
+    myFiles[f].inode=ino;
+    myFiles[f].used=1;   // set used to open
+    myFiles[f].file_num = inodes[ino].start; //set curr num to the start
+    myFiles[f].file_pos = 0;//set the curr pos to the start pos
+    myFiles[f].curr_len = 0;
+    inodes[ino].opens++;
+    raReset(f);
+    return(f);//return file handle
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_close
+// Description  : This function closes the file
+//
+// Inputs       : fd - the file descriptor
+//
+// Outputs      : 0 if successful, -1 if failure
+//
+int16_t cart_close(int16_t fd) {
+
+    aioDrain();
+    //STEP 1:: check if legit file handle
+    if(fd<0 || fd>=capFiles || myFiles[fd].used==-1)
+    {       
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_close bad file handle");
+    	return (-1);
+    }    
+    //STEP 2:: check if file is open
+    if(myFiles[fd].used==0)//used==0 means it is closed
+    {       
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_close file already closed");
+      	return (-1);
+    }
+    //STEP 3:: write back the file's frames, a failed write back leaves the descriptor open
+    if(ioqDrainFile(myFiles[fd].inode)==-1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_close cache write back failed");
+        return (-1);
+    }
+
+    //STEP 4:: set flag to close position, the descriptor can be handed out again
+    raReport(fd);
+    myFiles[fd].used=0;
+    if(--inodes[myFiles[fd].inode].opens==0)
+        allocRelease(myFiles[fd].inode);//the rest of its run can go to other files
+    myFiles[fd].nextFree=freeFile;
+    freeFile=fd;
     
-    myFiles[fd].file_pos = loc % 1024; 
-    // Return successfully
-	  return (0);
+	// Return successfully
+	return (0);
+}
+
+
+int32_t reader(uint16_t cart, uint16_t frame, void* buf)
+{
+     
+    void* t_buf=NULL;  
+        t_buf=get_cart_cache(cart*1024+frame);   
+
+    if(t_buf!=NULL)
+    {   
+        memcpy(buf,t_buf,1024);
+        return(0); //CACHE HIT!!!
+    }
+
+    if(tab.cart[cart].fUsed[frame]==0)
+        return (0);
+
+    //else cache miss :(
+    return(fetchFrame(cart,frame,buf));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fetchFrame
+// Description  : reads a frame from its cartridge over the bus and puts it in
+//                the cache
+//
+// Inputs       : cart - the cartridge of the frame
+//                frame - the frame in the cartridge
+//                buf - 1024 bytes to read the frame into
+// Outputs      : 0 if successful, -1 if failure
+//
+int32_t fetchFrame(uint16_t cart, uint16_t frame, void* buf)
+{
+    if(ioqGet(cart*1024+frame,buf))
+        return(put_cart_cache(cart*1024+frame, buf));//still waiting to be written, it is the newest copy
+
+    //the cart gets loaded anyway, send what is waiting for it first
+    if(ioq.head[cart]!=IOQ_NIL && ioqDrainCart(cart)==-1)
+        return(-1);
+
+    if(readFrame(cart*1024+frame,buf)==-1)
+        return(-1);
+
+    //fill the cache so the next read of this frame is a hit
+    if(put_cart_cache(cart*1024+frame, buf)==-1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Errror @ cache put on read");
+        return(-1);
+    }
+  
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extAppend
+// Description  : adds a frame to the end of a file's extent map, growing the
+//                last run if the frame follows it on the carts
+//
+// Inputs       : ino - the file's inode
+//                file_num - cart*1024+frame of the new last frame
+// Outputs      : 0 if successful, -1 if failure
+//
+int extAppend(int32_t ino, uint16_t file_num)
+{
+    struct Inode* f=&inodes[ino];
+    struct Extent* last=(f->nExt>0) ? &f->ext[f->nExt-1] : NULL;
+    struct Extent* grown;
+
+    if(last!=NULL && last->file_num+last->length==file_num && last->length<65535)
+    {
+        last->length++;
+        return(0);
+    }
+
+    if(f->nExt==f->capExt)//full, double it
+    {
+        grown=realloc(f->ext,sizeof(struct Extent)*((f->capExt>0) ? 2*f->capExt : EXT_INIT_SIZE));
+        if(grown==NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @extAppend out of memory for the extent map");
+            return(-1);
+        }
+        f->ext=grown;
+        f->capExt=(f->capExt>0) ? 2*f->capExt : EXT_INIT_SIZE;
+        last=(f->nExt>0) ? &f->ext[f->nExt-1] : NULL;
+    }
+
+    f->ext[f->nExt].first=(last!=NULL) ? last->first+last->length : 0;
+    f->ext[f->nExt].file_num=file_num;
+    f->ext[f->nExt].length=1;
+    f->nExt++;
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extFind
+// Description  : finds the frame at an index in a file, binary searching the
+//                extent map
+//
+// Inputs       : ino - the file's inode
+//                index - frame index in the file (byte offset / 1024)
+// Outputs      : cart*1024+frame, CART_CHAIN_END if the file is not that long
+//
+uint16_t extFind(int32_t ino, uint32_t index)
+{
+    struct Inode* f=&inodes[ino];
+    uint32_t lo=0, hi=f->nExt, mid;
+
+    while(hi-lo>1)//last extent with first <= index
+    {
+        mid=(lo+hi)/2;
+        if(f->ext[mid].first<=index)
+            lo=mid;
+        else
+            hi=mid;
+    }
+
+    if(f->nExt==0 || index-f->ext[lo].first>=f->ext[lo].length)
+        return(CART_CHAIN_END);
+    return(f->ext[lo].file_num+(index-f->ext[lo].first));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raReset
+// Description  : starts the readahead state of a file over, when it is opened
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+//
+void raReset(int16_t fd)
+{
+    myFiles[fd].ra_last=-1;
+    myFiles[fd].ra_head=0;
+    myFiles[fd].ra_pending=0;
+    myFiles[fd].ra_window=RA_INIT_WINDOW;
+    myFiles[fd].ra_seq=0;
+    myFiles[fd].ra_issued=0;
+    myFiles[fd].ra_hits=0;
+    myFiles[fd].ra_wasted=0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readAhead
+// Description  : called as the reader enters the frame at file_num, spots
+//                sequential reading and keeps the next ra_window frames of
+//                the chain in the cache ahead of it. The window grows by one
+//                on each read ahead frame the reader finds in the cache and
+//                halves when read ahead frames go unused
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+//
+void readAhead(int16_t fd)
+{
+    struct Filer* f=&myFiles[fd];
+    uint16_t cur=f->file_num, n, most, first;
+    int32_t k, got;
+
+    if(f->ra_last==cur)//still in the same frame
+        return;
+
+    if(f->ra_last>=0 && tab.cart[CNF(f->ra_last)].next[FNF(f->ra_last)]==cur)
+    {   //stepped onto the next frame of the chain
+        f->ra_seq++;
+        if(f->ra_pending>0)
+        {
+            f->ra_pending--;
+            if(probe_cart_cache(cur))
+            {
+                f->ra_hits++;
+                f->ra_window++;
+            }
+            else //pushed out of the cache before the reader got to it
+            {
+                f->ra_wasted++;
+                f->ra_window=(f->ra_window>1) ? f->ra_window/2 : 1;
+            }
+        }
+    }
+    else
+    {   //jumped, whatever was read ahead is not going to be used
+        if(f->ra_pending>0)
+        {
+            f->ra_wasted+=f->ra_pending;
+            f->ra_window=(f->ra_window>1) ? f->ra_window/2 : 1;
+        }
+        f->ra_pending=0;
+        f->ra_seq=0;
+    }
+    f->ra_last=cur;
+
+    //a window bigger than a share of the cache would push out its own frames
+    most=get_cart_cache_room()/RA_CACHE_SHARE;
+    if(most>RA_MAX_WINDOW)
+        most=RA_MAX_WINDOW;
+    if(f->ra_window>most)
+        f->ra_window=(most>0) ? most : 1;
+    if(most==0)
+        return;
+
+    //top the window up once half of it has been used
+    if(f->ra_seq<RA_TRIGGER || f->ra_pending>f->ra_window/2)
+        return;
+
+    n=(f->ra_pending>0) ? f->ra_head : cur;
+    first=tab.cart[CNF(n)].next[FNF(n)];
+    for(k=0;f->ra_pending<f->ra_window && tab.cart[CNF(n)].next[FNF(n)]!=CART_CHAIN_END;k++)
+    {
+        n=tab.cart[CNF(n)].next[FNF(n)];
+        f->ra_pending++;
+        f->ra_head=n;
+    }
+
+    //the frames the window grew by, in batches
+    if(k>0 && (got=fetchRun(first,k))>0)
+        f->ra_issued+=got;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raReport
+// Description  : logs the readahead counts of a file, when it is closed
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+//
+void raReport(int16_t fd)
+{
+    struct Filer* f=&myFiles[fd];
+
+    f->ra_wasted+=f->ra_pending;//never reached
+    f->ra_pending=0;
+    if(f->ra_issued==0 && f->ra_hits==0)
+        return;
+
+    logMessage(LOG_INFO_LEVEL,"Readahead [%s]: %u frames fetched, %u hits, %u wasted, window %u",
+        names.e[inodes[f->inode].name].path,f->ra_issued,f->ra_hits,f->ra_wasted,f->ra_window);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pinFrame
+// Description  : gets a frame for reading without copying it, a cache hit is
+//                pinned in place, otherwise the frame is read into spare
+//
+// Inputs       : cart - the cartridge of the frame
+//                frame - the frame in the cartridge
+//                spare - a 1024 byte buffer used when the frame is not pinned
+// Outputs      : pointer to the frame contents, NULL if failure
+//
+char* pinFrame(uint16_t cart, uint16_t frame, char* spare)
+{
+    char* src=pin_cart_cache(cart*1024+frame);
+
+    if(src!=NULL)
+        return(src); //CACHE HIT, read it where it sits
+
+    if(reader(cart,frame,spare)==-1)
+        return(NULL);
+    return(spare);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unpinFrame
+// Description  : lets go of a frame from pinFrame
+//
+// Inputs       : src - the pointer pinFrame returned
+//                spare - the spare buffer given to pinFrame
+// Outputs      : none
+//
+void unpinFrame(char* src, char* spare)
+{
+    if(src!=spare)
+        unpin_cart_cache(src);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushFrame
+// Description  : queues one frame for its cartridge, the cache calls this
+//                for write through and for dirty write backs. A frame that
+//                is already waiting is overwritten in place, and a full
+//                queue is sent to the carts before taking the frame
+//
+// Inputs       : file_num - cart*1024 + frame
+//                buf - the 1024 byte frame
+// Outputs      : 0 if successful, -1 if failure
+//
+int flushFrame(uint32_t file_num, void* buf)
+{
+    uint16_t cart=CNF(file_num);
+    int16_t n=ioqSlot(file_num);
+
+    ioq.queued++;
+    if(n!=IOQ_NIL)//newer copy of a frame still waiting
+    {
+        memcpy(ioq.data[n],buf,CART_FRAME_SIZE);
+        ioq.merged++;
+        return(0);
+    }
+
+    if(ioq.count==IOQ_DEPTH && ioqDrain()==-1)
+        return(-1);
+
+    n=ioq.freeSlot;
+    ioq.freeSlot=ioq.next[n];
+    ioq.count++;
+    ioq.busy[n]=1;
+    memcpy(ioq.data[n],buf,CART_FRAME_SIZE);
+    ioq.file_num[n]=file_num;
+    ioq.slot[file_num]=n;
+    ioq.next[n]=IOQ_NIL;
+    if(ioq.head[cart]==IOQ_NIL)
+        ioq.head[cart]=n;
+    else
+        ioq.next[ioq.tail[cart]]=n;
+    ioq.tail[cart]=n;
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqInit
+// Description  : empties the write queue, at power on. The frame to slot
+//                index is left as it is, ioqSlot checks it against the slot
+//
+// Inputs       : none
+// Outputs      : none
+//
+void ioqInit()
+{
+    int i;
+
+    for(i=0;i<IOQ_DEPTH;i++)
+    {
+        ioq.next[i]=(i+1<IOQ_DEPTH) ? i+1 : IOQ_NIL;
+        ioq.busy[i]=0;
+    }
+    for(i=0;i<CART_MAX_CARTRIDGES;i++)
+        ioq.head[i]=ioq.tail[i]=IOQ_NIL;
+    ioq.freeSlot=0;
+    ioq.count=0;
+    ioq.queued=ioq.merged=ioq.sent=0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqGet
+// Description  : copies a frame out of the write queue if it is waiting there
+//
+// Inputs       : file_num - cart*1024 + frame
+//                buf - 1024 bytes to copy the frame into
+// Outputs      : 1 if the frame was waiting, 0 if not
+//
+int ioqGet(uint16_t file_num, void* buf)
+{
+    int16_t n=ioqSlot(file_num);
+
+    if(n==IOQ_NIL)
+        return(0);
+    memcpy(buf,ioq.data[n],CART_FRAME_SIZE);
+    return(1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqCancel
+// Description  : drops a queued write of a frame that was freed, so a stale
+//                copy never lands on a frame another file has by then
+//
+// Inputs       : file_num - cart*1024 + frame
+// Outputs      : none
+//
+void ioqCancel(uint16_t file_num)
+{
+    uint16_t cart=CNF(file_num);
+    int16_t n=ioqSlot(file_num), p;
+
+    if(n==IOQ_NIL)
+        return;
+
+    if(ioq.head[cart]==n)
+    {
+        ioq.head[cart]=ioq.next[n];
+        p=IOQ_NIL;
+    }
+    else
+    {
+        for(p=ioq.head[cart];ioq.next[p]!=n;p=ioq.next[p]);
+        ioq.next[p]=ioq.next[n];
+    }
+    if(ioq.tail[cart]==n)
+        ioq.tail[cart]=p;
+
+    ioq.busy[n]=0;
+    ioq.next[n]=ioq.freeSlot;
+    ioq.freeSlot=n;
+    ioq.count--;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqSlot
+// Description  : finds the queue slot holding a frame
+//
+// Inputs       : file_num - cart*1024 + frame
+// Outputs      : the slot, IOQ_NIL if the frame is not waiting
+//
+int16_t ioqSlot(uint16_t file_num)
+{
+    int16_t n=ioq.slot[file_num];
+
+    if(n<0 || n>=IOQ_DEPTH || !ioq.busy[n] || ioq.file_num[n]!=file_num)
+        return(IOQ_NIL);
+    return(n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqSend
+// Description  : sends queued writes in the order given, frames next to
+//                each other on the same cart go in one batched request.
+//                They all go out before the first response is read, the
+//                slots are left for the caller to free
+//
+// Inputs       : order - the slots, sorted by frame
+//                k - number of slots
+// Outputs      : 0 if successful, -1 if failure
+//
+int ioqSend(int16_t* order, int k)
+{
+    int i, j, len, most=(tab.batch) ? BUS_BATCH : 1;
+
+    for(i=0;i<k;i+=len)
+    {
+        for(len=1;i+len<k && len<most && ioq.file_num[order[i+len]]==ioq.file_num[order[i]]+len
+            && CNF(ioq.file_num[order[i+len]])==CNF(ioq.file_num[order[i]]);len++);
+        if(len==1)
+        {
+            if(writeRun(ioq.file_num[order[i]],1,ioq.data[order[i]])==-1)
+                return(-1);
+            continue;
+        }
+        for(j=0;j<len;j++)
+            memcpy(&busOut[j*CART_FRAME_SIZE],ioq.data[order[i+j]],CART_FRAME_SIZE);
+        if(writeRun(ioq.file_num[order[i]],len,busOut)==-1)
+            return(-1);
+    }
+    return(busReap());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqDrainCart
+// Description  : sends the writes waiting for one cart in frame order
+//
+// Inputs       : cart - the cart
+// Outputs      : 0 if successful, -1 if failure
+//
+int ioqDrainCart(uint16_t cart)
+{
+    int16_t order[IOQ_DEPTH], n;
+    int k=0, i, j;
+
+    for(n=ioq.head[cart];n!=IOQ_NIL;n=ioq.next[n])//insertion sort, the queue is short
+    {
+        for(j=k;j>0 && ioq.file_num[order[j-1]]>ioq.file_num[n];j--)
+            order[j]=order[j-1];
+        order[j]=n;
+        k++;
+    }
+
+    if(ioqSend(order,k)==-1)
+        return(-1);
+
+    for(i=0;i<k;i++)
+    {
+        n=order[i];
+        ioq.busy[n]=0;
+        ioq.next[n]=ioq.freeSlot;
+        ioq.freeSlot=n;
+        ioq.count--;
+        ioq.sent++;
+    }
+    ioq.head[cart]=IOQ_NIL;
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqDrain
+// Description  : sends every waiting write, a cart at a time, sweeping up
+//                from the loaded cart so each cart is loaded once
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int ioqDrain()
+{
+    uint16_t c, first=(tab.cI<CART_MAX_CARTRIDGES) ? tab.cI : 0;
+
+    for(c=0;c<CART_MAX_CARTRIDGES && ioq.count>0;c++)
+        if(ioqDrainCart((first+c)%CART_MAX_CARTRIDGES)==-1)
+            return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioqDrainFile
+// Description  : writes back one file's frames, the dirty ones the cache is
+//                holding and then the ones waiting in the queue, leaving
+//                every other file's writes where they are
+//
+// Inputs       : ino - the file's inode
+// Outputs      : 0 if successful, -1 if failure
+//
+int ioqDrainFile(int32_t ino)
+{
+    struct Inode* f=&inodes[ino];
+    int16_t order[IOQ_DEPTH], n;
+    uint32_t e, i;
+    int k=0, j;
+
+    //the cache first, a write back can fill the queue and send it
+    for(e=0;e<f->nExt;e++)
+        for(i=0;i<f->ext[e].length;i++)
+            if(flush_cart_cache(f->ext[e].file_num+i)==-1)
+                return(-1);
+
+    for(e=0;e<f->nExt && ioq.count>0;e++)
+        for(i=0;i<f->ext[e].length;i++)
+        {
+            if((n=ioqSlot(f->ext[e].file_num+i))==IOQ_NIL)
+                continue;
+            for(j=k;j>0 && ioq.file_num[order[j-1]]>ioq.file_num[n];j--)
+                order[j]=order[j-1];
+            order[j]=n;
+            k++;
+        }
+    if(k==0)
+        return(0);
+
+    if(ioqSend(order,k)==-1)
+        return(-1);
+    for(j=0;j<k;j++)
+    {
+        ioqCancel(ioq.file_num[order[j]]);
+        ioq.sent++;
+    }
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readFrame
+// Description  : reads one frame from its cartridge over the bus
+//
+// Inputs       : file_num - cart*1024 + frame
+//                buf - 1024 bytes to read the frame into
+// Outputs      : 0 if successful, -1 if failure
+//
+int readFrame(uint32_t file_num, void* buf)
+{
+    loadCart(CNF(file_num));//check that cartridge is good and sets cI
+    sReg= stitch(CART_OP_RDFRME,0,0,0,FNF(file_num));
+    //rReg= cart_io_bus(sReg,buf);
+    rReg=cart_client_bus_request(sReg, buf);
+     
+    if( unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1))
+    {       
+        logMessage(LOG_ERROR_LEVEL,"Error in readFrame in write frame"); 
+        return(-1);
+    }
+    if(rRT1!=0)
+    {       
+        logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @readframe in write frame");
+        return(-1);
+    }
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeFrame
+// Description  : writes one frame to its cartridge over the bus
+//
+// Inputs       : file_num - cart*1024 + frame
+//                buf - the 1024 byte frame
+// Outputs      : 0 if successful, -1 if failure
+//
+int writeFrame(uint32_t file_num, void* buf)
+{
+    uint16_t frame=FNF(file_num);
+
+    loadCart(CNF(file_num));//check that cartridge is good and sets cI
+    sReg= stitch(CART_OP_WRFRME,0,0,0,frame);
+   // rReg= cart_io_bus(sReg,buf);
+    rReg=cart_client_bus_request(sReg, buf);
+
+    if( unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1))
+    {       
+        logMessage(LOG_ERROR_LEVEL,"Error in write writeFrame "); 
+        return(-1);
+    }
+    if(rRT1!=0)
+    { 
+        logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @ writeframe");
+        return(-1);
+    }
+
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readRun
+// Description  : asks for n frames that follow each other in a cart, in one
+//                RDFRMS request if the server takes them. The frames are in
+//                buf once busReap comes back
+//
+// Inputs       : file_num - cart*1024+frame of the first frame
+//                n - frames, all in the same cart
+//                buf - n*1024 bytes to read into
+// Outputs      : 0 if successful, -1 if failure
+//
+int readRun(uint32_t file_num, uint16_t n, void* buf)
+{
+    uint16_t i;
+
+    if(tab.cI!=CNF(file_num) && busReap()==-1)
+        return(-1);//the cart load waits for what is in flight
+    loadCart(CNF(file_num));//check that cartridge is good and sets cI
+
+    if(n>1 && tab.batch)
+        return(busPost(stitch(CART_OP_RDFRMS,0,0,0,FNF(file_num)) | n,buf));
+    for(i=0;i<n;i++)
+        if(busPost(stitch(CART_OP_RDFRME,0,0,0,FNF(file_num+i)),(char*)buf+i*CART_FRAME_SIZE)==-1)
+            return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeRun
+// Description  : sends n frames that follow each other in a cart, in one
+//                WRFRMS request if the server takes them. buf can be reused
+//                on return, busReap says if the writes went through
+//
+// Inputs       : file_num - cart*1024+frame of the first frame
+//                n - frames, all in the same cart
+//                buf - n*1024 bytes to write
+// Outputs      : 0 if successful, -1 if failure
+//
+int writeRun(uint32_t file_num, uint16_t n, void* buf)
+{
+    uint16_t i;
+
+    if(tab.cI!=CNF(file_num) && busReap()==-1)
+        return(-1);//the cart load waits for what is in flight
+    loadCart(CNF(file_num));//check that cartridge is good and sets cI
+
+    if(n>1 && tab.batch)
+        return(busPost(stitch(CART_OP_WRFRMS,0,0,0,FNF(file_num)) | n,buf));
+    for(i=0;i<n;i++)
+        if(busPost(stitch(CART_OP_WRFRME,0,0,0,FNF(file_num+i)),(char*)buf+i*CART_FRAME_SIZE)==-1)
+            return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : busPost
+// Description  : sends a request without waiting for it, reading the oldest
+//                responses first while the client window is full
+//
+// Inputs       : reg - the request
+//                buf - the frames read into/written from
+// Outputs      : 0 if successful, -1 if failure
+//
+int busPost(CartXferRegister reg, void* buf)
+{
+    while(!cart_client_bus_room(reg))
+    {
+        rReg=cart_client_bus_complete();
+        unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1);
+        if(rRT1!=0)
+        {
+            busReap();
+            logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @busPost");
+            return(-1);
+        }
+    }
+    if(cart_client_bus_submit(reg,buf)==-1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @busPost submit");
+        return(-1);
+    }
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : busReap
+// Description  : reads the responses to every request in flight
+//
+// Inputs       : none
+// Outputs      : 0 if they all went through, -1 if any failed
+//
+int busReap()
+{
+    int bad=0;
+
+    while(cart_client_bus_pending()>0)
+    {
+        rReg=cart_client_bus_complete();
+        unstitch(rReg,&rKY1,&rKY2,&rRT1,&rCT1,&rFM1);
+        bad|=(rRT1!=0);
+    }
+    if(bad)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error( rRT1 != 0) @busReap");
+        return(-1);
+    }
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fetchRun
+// Description  : reads the frames of a chain from file_num on into the cache,
+//                the ones it does not have yet. Frames next to each other on
+//                a cart are read in one batched request, and the requests
+//                are kept in flight until busBuf is full. Frames never written
+//                and frames waiting in the write queue are left to reader
+//
+// Inputs       : file_num - first frame of the chain to look at
+//                frames - frames of the chain to look at
+// Outputs      : frames read from the carts, -1 if failure
+//
+int32_t fetchRun(uint16_t file_num, uint32_t frames)
+{
+    uint16_t n=file_num, first=CART_CHAIN_END, at[BUS_BATCH];
+    uint32_t i;
+    int32_t got=0, len=0, used=0, most=(tab.batch) ? BUS_BATCH : 1, need, j;
+
+    for(i=0;i<=frames;i++)
+    {
+        need=(i<frames && n!=CART_CHAIN_END && tab.cart[CNF(n)].fUsed[FNF(n)]!=0 &&
+              ioqSlot(n)==IOQ_NIL && !probe_cart_cache(n));
+
+        //a run ends at a frame not needed, a gap, another cart or a full batch
+        if(len>0 && (!need || n!=first+len || CNF(n)!=CNF(first) || len==most))
+        {
+            if(ioq.head[CNF(first)]!=IOQ_NIL && ioqDrainCart(CNF(first))==-1)
+                return(-1);//the cart gets loaded anyway, send what is waiting for it first
+            if(readRun(first,len,&busBuf[used*CART_FRAME_SIZE])==-1)
+                return(-1);
+            for(j=0;j<len;j++)
+                at[used++]=first+j;
+            len=0;
+        }
+
+        //the next run might not fit in busBuf, or this is the end: take in what came back
+        if(used>0 && (used+most>BUS_BATCH || i==frames || n==CART_CHAIN_END))
+        {
+            if(busReap()==-1)
+                return(-1);
+            for(j=0;j<used;j++)
+                if(put_cart_cache(at[j],&busBuf[j*CART_FRAME_SIZE])==-1)
+                {
+                    logMessage(LOG_ERROR_LEVEL,"Errror @ cache put on read");
+                    return(-1);
+                }
+            got+=used;
+            used=0;
+        }
+        if(i==frames || n==CART_CHAIN_END)
+            break;
+
+        if(need && len++==0)
+            first=n;
+        n=tab.cart[CNF(n)].next[FNF(n)];
+    }
+    return(got);
+}
+
+
+int32_t writer(uint16_t cart, uint16_t frame, void* buf)
+{    //write myBuf to the frame, the cache decides if it goes out now or later
+        if(write_cart_cache(cart*1024+frame, buf)==-1)
+        {    
+            logMessage(LOG_ERROR_LEVEL,"Errror @ cache put");
+            return(-1);
+        }
+
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_read
+// Description  : Reads "count" bytes from the file handle "fh" into the 
+//                buffer "buf"
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+// Outputs      : bytes read if successful, -1 if failure
+//
+int32_t cart_read(int16_t fd, void *buf, int32_t count) {
+
+    aioDrain();
+    //STEP 1:: Check if file handle is legit and open
+    if(fdCheck(fd,"cart_read")==-1)
+        return(-1);
+    
+    //STEP 2:: each frame is copied once, from the cache to buf
+    struct iovec v={buf,(count>0) ? count : 0};
+	return (readFrames(fd,&v,1));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write
+// Description  : Writes "count" bytes to the file handle "fh" from the 
+//                buffer  "buf"
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
+//
+int32_t cart_write(int16_t fd, void *buf, int32_t count) 
+{
+    aioDrain();
+    if(fdCheck(fd,"cart_write")==-1)
+        return(-1);
+    struct iovec v={buf,(count>0) ? count : 0};
+    return(writeFrames(fd,&v,1)); 
+}
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fd - filename of the file to write to
+//                loc - offfset of file in relation to beginning of file
+// Outputs      : 0 if successful, -1 if failure
+int32_t cart_seek(int16_t fd, uint32_t loc) 
+{
+    aioDrain();
+    if(fdCheck(fd,"cart_seek")==-1)
+        return(-1);
+ 
+    //STEP 2:: check if position is in the file 
+    if(loc> inodes[myFiles[fd].inode].length)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_seek loc>length");
+        return (-1);
+    }       
+
+
+   /* myFiles[fd].offset=1;//set the offset flag to on(1)
+    //STEP 4:: reset position
+    myFiles[fd].file_num= loc/1024;
+    myFiles[fd].file_pos= loc%1024;
+    */
+    //the extent map finds the frame without walking the chain
+    myFiles[fd].file_num= extFind(myFiles[fd].inode,loc/1024);
+    
+    myFiles[fd].curr_len=loc;
+    
+    myFiles[fd].file_pos = loc % 1024; 
+    // Return successfully
+	  return (0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pread
+// Description  : Reads "count" bytes at offset into "buf", the file's
+//                position stays where it was
+//
+// Inputs       : fd - file handle to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+//                offset - where in the file to read from
+// Outputs      : bytes read if successful, -1 if failure
+//
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t offset)
+{
+    struct iovec v={buf,(count>0) ? count : 0};
+
+    aioDrain();
+    return(ioAt(fd,&v,1,offset,0));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pwrite
+// Description  : Writes "count" bytes from "buf" at offset, the file's
+//                position stays where it was
+//
+// Inputs       : fd - file handle to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+//                offset - where in the file to write, at most its length
+// Outputs      : bytes written if successful, -1 if failure
+//
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t offset)
+{
+    struct iovec v={buf,(count>0) ? count : 0};
+
+    aioDrain();
+    return(ioAt(fd,&v,1,offset,1));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_readv
+// Description  : Reads into each buffer of an iovec array in turn, from the
+//                file's position, in one pass over the frames
+//
+// Inputs       : fd - file handle to read from
+//                iov - buffers to fill
+//                iovcnt - buffers in iov
+// Outputs      : bytes read if successful, -1 if failure
+//
+int32_t cart_readv(int16_t fd, const struct iovec *iov, int iovcnt)
+{
+    aioDrain();
+    if(fdCheck(fd,"cart_readv")==-1 || iovTotal(iov,iovcnt)==-1)
+        return(-1);
+    return(readFrames(fd,iov,iovcnt));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_writev
+// Description  : Writes each buffer of an iovec array in turn, at the file's
+//                position, in one pass over the frames
+//
+// Inputs       : fd - file handle to write to
+//                iov - buffers to write
+//                iovcnt - buffers in iov
+// Outputs      : bytes written if successful, -1 if failure
+//
+int32_t cart_writev(int16_t fd, const struct iovec *iov, int iovcnt)
+{
+    aioDrain();
+    if(fdCheck(fd,"cart_writev")==-1 || iovTotal(iov,iovcnt)==-1)
+        return(-1);
+    return(writeFrames(fd,iov,iovcnt));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioAt
+// Description  : reads or writes at an offset, putting the descriptor's
+//                position back after. The extent map finds the frame, there
+//                is no walk along the chain to get there
+//
+// Inputs       : fd - file handle
+//                iov - buffers
+//                iovcnt - buffers in iov
+//                offset - where in the file, at most its length
+//                write - 1 to write, 0 to read
+// Outputs      : bytes moved if successful, -1 if failure
+//
+int32_t ioAt(int16_t fd, const struct iovec* iov, int iovcnt, uint32_t offset, int write)
+{
+    uint16_t file_num, file_pos;
+    uint32_t curr_len;
+    int32_t n;
+
+    if(fdCheck(fd,(write) ? "cart_pwrite" : "cart_pread")==-1 || iovTotal(iov,iovcnt)==-1)
+        return(-1);
+    if(offset>inodes[myFiles[fd].inode].length)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @ioAt offset %u past the end %u",offset,inodes[myFiles[fd].inode].length);
+        return(-1);
+    }
+
+    file_num=myFiles[fd].file_num;
+    file_pos=myFiles[fd].file_pos;
+    curr_len=myFiles[fd].curr_len;
+
+    myFiles[fd].file_num=extFind(myFiles[fd].inode,offset/CART_FRAME_SIZE);
+    myFiles[fd].file_pos=offset%CART_FRAME_SIZE;
+    myFiles[fd].curr_len=offset;
+    n=(write) ? writeFrames(fd,iov,iovcnt) : readFrames(fd,iov,iovcnt);
+
+    myFiles[fd].file_num=file_num;
+    myFiles[fd].file_pos=file_pos;
+    myFiles[fd].curr_len=curr_len;
+    return(n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readFrames
+// Description  : reads from a descriptor's position into a list of buffers,
+//                frame by frame along the chain. Each frame is pinned once
+//                and copied to as many buffers as it spans. The read stops
+//                at the end of the file
+//
+// Inputs       : fd - an open file handle
+//                iov - buffers to fill in order
+//                iovcnt - buffers in iov
+// Outputs      : bytes read if successful (short at the end of the file),
+//                -1 if failure
+//
+int32_t readFrames(int16_t fd, const struct iovec* iov, int iovcnt)
+{
+    char spare[1024];
+    char *src;
+    int32_t read=0, n, most;
+    int64_t count=iovTotal(iov,iovcnt), left=(int64_t)inodes[myFiles[fd].inode].length-myFiles[fd].curr_len;
+    int v=0, i;
+    size_t vo=0;
+
+    if(count>left)//nothing past the end, and no frame after the last one is pinned
+        count=(left>0) ? left : 0;
+
+    while(read<count && iovSkip(iov,iovcnt,&v,&vo))
+    {
+        i=myFiles[fd].file_pos;
+        readAhead(fd);
+
+        //a miss reads the rest of the request with it, in batches, as far as the cache holds it
+        most=get_cart_cache_room()/RA_CACHE_SHARE;
+        if(most>1 && !probe_cart_cache(myFiles[fd].file_num) && (i+count-read)>CART_FRAME_SIZE)
+        {
+            if((i+count-read+CART_FRAME_SIZE-1)/CART_FRAME_SIZE<most)
+                most=(i+count-read+CART_FRAME_SIZE-1)/CART_FRAME_SIZE;
+            if(fetchRun(myFiles[fd].file_num,most)==-1)
+                return(-1);
+        }
+
+        src=pinFrame(CNF(myFiles[fd].file_num), FNF(myFiles[fd].file_num),spare);
+        if(src==NULL)
+            return(-1);
+        n=iovMove(iov,iovcnt,&v,&vo,&src[i],(count-read<1024-i) ? count-read : 1024-i,0);
+        unpinFrame(src,spare);
+
+        myFiles[fd].curr_len+=n;
+        read+=n;
+        if(i+n==1024)//read to the end of the frame, on to the next one
+        {
+            myFiles[fd].file_num= tab.cart[CNF(myFiles[fd].file_num)].next[FNF(myFiles[fd].file_num)];
+            myFiles[fd].file_pos=0;
+        }
+        else
+            myFiles[fd].file_pos=i+n;
+    }
+    return(read);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeFrames
+// Description  : writes a list of buffers at a descriptor's position, frame
+//                by frame along the chain, adding frames past the end. A
+//                frame written whole from one buffer goes to the cache
+//                straight from it, with no read first
+//
+// Inputs       : fd - an open file handle
+//                iov - buffers to write in order
+//                iovcnt - buffers in iov
+// Outputs      : bytes written if successful, -1 if failure
+//
+int32_t writeFrames(int16_t fd, const struct iovec* iov, int iovcnt)
+{
+    struct Inode* node=&inodes[myFiles[fd].inode];
+    int64_t count=iovTotal(iov,iovcnt);
+    char myBuf[1024];
+    int32_t written=0, n;
+    int v=0, i;
+    size_t vo=0;
+    uint16_t fn, next;
+
+    while(count>0 && iovSkip(iov,iovcnt,&v,&vo))
+    {
+        fn=myFiles[fd].file_num;
+        i=myFiles[fd].file_pos;
+        n=(count<1024-i) ? count : 1024-i;
+
+        if(n==1024 && iov[v].iov_len-vo>=1024)//the whole frame is new and in one buffer
+        {
+            if(writer(CNF(fn),FNF(fn),(char*)iov[v].iov_base+vo)==-1)
+                return(-1);
+            iovMove(iov,iovcnt,&v,&vo,NULL,n,1);
+        }
+        else
+        {
+            //keep what is around the write, unless it is past the end of the file
+            if(n==1024 || (i==0 && myFiles[fd].curr_len+n>=node->length))
+                memset(myBuf,0,sizeof(myBuf));
+            else if(reader(CNF(fn),FNF(fn),myBuf)==-1)
+                return(-1);
+            iovMove(iov,iovcnt,&v,&vo,&myBuf[i],n,1);
+            if(writer(CNF(fn),FNF(fn),myBuf)==-1)
+                return(-1);
+        }
+
+        myFiles[fd].curr_len+=n;
+        written+=n;
+        count-=n;
+
+        if(i+n==1024)//frame full, on to the next one
+        {
+            next=tab.cart[CNF(fn)].next[FNF(fn)];
+            if(next==CART_CHAIN_END)//the last frame of the file needs a next frame
+            {
+                next=allocFrame(myFiles[fd].inode);
+                if(next==CART_CHAIN_END)
+                    return(-1);
+                tab.cart[CNF(fn)].fUsed[FNF(fn)]=1023;
+                tab.cart[CNF(fn)].next[FNF(fn)]=next;
+                if(extAppend(myFiles[fd].inode,next)==-1)
+                    return(-1);
+                tab.cUsed[CNF(fn)]++;
+            }
+            myFiles[fd].file_num=next;
+            myFiles[fd].file_pos=0;
+            if(node->length<myFiles[fd].curr_len)
+                node->length=myFiles[fd].curr_len;
+        }
+        else
+        {
+            myFiles[fd].file_pos+=n;
+            if(node->length<myFiles[fd].curr_len)
+            {//past the end, the file grows
+                node->length=myFiles[fd].curr_len;
+                tab.cart[CNF(fn)].fUsed[FNF(fn)]=i+n;
+            }  //else u r overwrighting and not using more memory
+        }
+    }
+
+    return(written); 
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fdCheck
+// Description  : checks a file handle is open
+//
+// Inputs       : fd - file handle
+//                who - function name for the log
+// Outputs      : 0 if it is open, -1 if not
+//
+int fdCheck(int16_t fd, const char* who)
+{
+    if(fd<0 || fd>=capFiles || myFiles[fd].used!=1)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @%s bad file handle %d",who,fd);
+        return(-1);
+    }
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iovTotal
+// Description  : adds up the bytes in an iovec array, a call moves at most
+//                what fits in its int32_t result
+//
+// Inputs       : iov - buffers
+//                iovcnt - buffers in iov
+// Outputs      : the bytes, -1 if the array is bad or too big
+//
+int64_t iovTotal(const struct iovec* iov, int iovcnt)
+{
+    int64_t total=0;
+    int v;
+
+    if(iovcnt<0 || (iov==NULL && iovcnt>0))
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @iovTotal bad iovec array of %d",iovcnt);
+        return(-1);
+    }
+    for(v=0;v<iovcnt;v++)
+    {
+        total+=iov[v].iov_len;
+        if(iov[v].iov_len>INT32_MAX || total>INT32_MAX)
+        {
+            logMessage(LOG_ERROR_LEVEL,"Error @iovTotal more than %d bytes",INT32_MAX);
+            return(-1);
+        }
+    }
+    return(total);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iovSkip
+// Description  : moves past used up and empty buffers
+//
+// Inputs       : iov - buffers
+//                iovcnt - buffers in iov
+//                v, vo - the buffer and the bytes of it done, updated
+// Outputs      : 1 if there are bytes left, 0 at the end
+//
+int iovSkip(const struct iovec* iov, int iovcnt, int* v, size_t* vo)
+{
+    while(*v<iovcnt && *vo==iov[*v].iov_len)
+    {
+        (*v)++;
+        *vo=0;
+    }
+    return(*v<iovcnt);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iovMove
+// Description  : copies up to n bytes between part of a frame and the
+//                buffers, from where the last copy stopped
+//
+// Inputs       : iov - buffers
+//                iovcnt - buffers in iov
+//                v, vo - the buffer and the bytes of it done, updated
+//                frame - the part of the frame, NULL just to move past n bytes
+//                n - bytes
+//                toFrame - 1 to copy from the buffers to the frame, 0 back
+// Outputs      : bytes copied, less than n at the end of the buffers
+//
+int32_t iovMove(const struct iovec* iov, int iovcnt, int* v, size_t* vo, char* frame, int32_t n, int toFrame)
+{
+    int32_t done=0, k;
+
+    while(done<n && iovSkip(iov,iovcnt,v,vo))
+    {
+        k=(iov[*v].iov_len-*vo<(size_t)(n-done)) ? iov[*v].iov_len-*vo : n-done;
+        if(frame!=NULL && toFrame)
+            memcpy(&frame[done],(char*)iov[*v].iov_base+*vo,k);
+        else if(frame!=NULL)
+            memcpy((char*)iov[*v].iov_base+*vo,&frame[done],k);
+        *vo+=k;
+        done+=k;
+    }
+    return(done);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_aio_read
+// Description  : queues a read of req->count bytes at req->offset into
+//                req->buf and returns at once. The I/O thread does the read,
+//                cart_aio_poll/cart_aio_wait or req->done say when it is over
+//
+// Inputs       : req - the request, the driver's until it finishes
+// Outputs      : 0 if queued, -1 if failure
+//
+int32_t cart_aio_read(CartAio *req)
+{
+    return(aioSubmit(req,0));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_aio_write
+// Description  : queues a write of req->count bytes from req->buf at
+//                req->offset and returns at once, buf has to stay as it is
+//                until the write finishes
+//
+// Inputs       : req - the request, the driver's until it finishes
+// Outputs      : 0 if queued, -1 if failure
+//
+int32_t cart_aio_write(CartAio *req)
+{
+    return(aioSubmit(req,1));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_aio_poll
+// Description  : says if a request has finished, without waiting
+//
+// Inputs       : req - a submitted request
+// Outputs      : 1 if finished (req->result is good), 0 if not yet, -1 if
+//                it was never submitted
+//
+int32_t cart_aio_poll(CartAio *req)
+{
+    int32_t state=__atomic_load_n(&req->state,__ATOMIC_ACQUIRE);
+
+    if(state!=AIO_QUEUED && state!=AIO_DONE)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @cart_aio_poll request was not submitted");
+        return(-1);
+    }
+    return(state==AIO_DONE);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_aio_wait
+// Description  : sleeps until a request has finished
+//
+// Inputs       : req - a submitted request
+// Outputs      : the request's result, bytes moved or -1 if failure
+//
+int32_t cart_aio_wait(CartAio *req)
+{
+    if(cart_aio_poll(req)==-1)
+        return(-1);
+
+    pthread_mutex_lock(&aio.lock);
+    while(__atomic_load_n(&req->state,__ATOMIC_ACQUIRE)!=AIO_DONE)
+        pthread_cond_wait(&aio.done,&aio.lock);
+    pthread_mutex_unlock(&aio.lock);
+    return(req->result);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioSubmit
+// Description  : checks a request and puts it in the ring
+//
+// Inputs       : req - the request
+//                write - 1 to write, 0 to read
+// Outputs      : 0 if queued, -1 if failure
+//
+int32_t aioSubmit(CartAio* req, int8_t write)
+{
+    int32_t state;
+    int put;
+
+    if(req==NULL || req->count<0 || (req->buf==NULL && req->count>0))
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @aioSubmit bad request");
+        return(-1);
+    }
+
+    if(!__atomic_load_n(&aio.on,__ATOMIC_ACQUIRE))
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @aioSubmit power is off");
+        return(-1);
+    }
+
+    //the request is taken with a compare and swap, a second submit of it fails
+    state=__atomic_load_n(&req->state,__ATOMIC_ACQUIRE);
+    if(state==AIO_QUEUED || !__atomic_compare_exchange_n(&req->state,&state,AIO_QUEUED,0,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED))
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @aioSubmit request is queued already");
+        return(-1);
+    }
+
+    req->write=write;
+    req->result=-1;
+    put=aioPut(req);
+    if(put!=0)
+    {
+        __atomic_store_n(&req->state,0,__ATOMIC_RELEASE);
+        if(put==-2)
+            logMessage(LOG_ERROR_LEVEL,"Error @aioSubmit power is off");
+        else
+            logMessage(LOG_ERROR_LEVEL,"Error @aioSubmit %u requests waiting already",AIO_RING);
+        return(-1);
+    }
+    __atomic_add_fetch(&aio.submitted,1,__ATOMIC_RELEASE);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioPut
+// Description  : puts a request in the ring without a lock, any number of
+//                threads can put at once. A slot is claimed by moving the
+//                tail on with a compare and swap, then handed to the I/O
+//                thread through its sequence number. The stop claims its
+//                slot and sets AIO_CLOSED in the same swap, so a put that
+//                loses to it sees the ring closed and nothing lands after it
+//
+// Inputs       : req - the request, NULL tells the I/O thread to stop
+// Outputs      : 0 if successful, -1 if the ring is full, -2 if it is closed
+//
+int aioPut(CartAio* req)
+{
+    uint64_t tail=__atomic_load_n(&aio.tail,__ATOMIC_RELAXED), next;
+    uint32_t pos, seq;
+
+    for(;;)
+    {
+        if(tail & AIO_CLOSED)
+            return(-2);
+        pos=(uint32_t)tail;
+        seq=__atomic_load_n(&aio.seq[pos&(AIO_RING-1)],__ATOMIC_ACQUIRE);
+        if((int32_t)(seq-pos)<0)
+            return(-1);//the I/O thread has not taken this slot's last request
+        next=(uint32_t)(pos+1) | ((req==NULL) ? AIO_CLOSED : 0);
+        if(seq==pos && __atomic_compare_exchange_n(&aio.tail,&tail,next,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+            break;
+        if(seq!=pos)
+            tail=__atomic_load_n(&aio.tail,__ATOMIC_RELAXED);//another thread took it first
+    }
+
+    aio.req[pos&(AIO_RING-1)]=req;
+    __atomic_store_n(&aio.seq[pos&(AIO_RING-1)],pos+1,__ATOMIC_RELEASE);
+    sem_post(&aio.ready);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioThread
+// Description  : the I/O thread, it takes requests out of the ring in the
+//                order they were put and does them one at a time, so the
+//                bus is only used from here while requests are waiting
+//
+// Inputs       : arg - not used
+// Outputs      : NULL
+//
+void* aioThread(void* arg)
+{
+    CartAio* req;
+    struct iovec v;
+    uint32_t pos;
+
+    for(;;)
+    {
+        while(sem_wait(&aio.ready)==-1);//interrupted, go back
+
+        //the put that posted might not be the one at head, wait for that one to land
+        pos=aio.head;
+        while(__atomic_load_n(&aio.seq[pos&(AIO_RING-1)],__ATOMIC_ACQUIRE)!=pos+1)
+            sched_yield();
+        req=aio.req[pos&(AIO_RING-1)];
+        __atomic_store_n(&aio.seq[pos&(AIO_RING-1)],pos+AIO_RING,__ATOMIC_RELEASE);
+        aio.head=pos+1;
+        if(req==NULL)
+            return(NULL);
+        aio.taken++;
+
+        v.iov_base=req->buf;
+        v.iov_len=req->count;
+        req->result=ioAt(req->fd,&v,1,req->offset,req->write);
+        if(req->done!=NULL)
+            req->done(req);
+
+        //the request can be reused as soon as it says it is done
+        pthread_mutex_lock(&aio.lock);
+        __atomic_store_n(&req->state,AIO_DONE,__ATOMIC_RELEASE);
+        __atomic_add_fetch(&aio.finished,1,__ATOMIC_RELEASE);
+        pthread_cond_broadcast(&aio.done);
+        pthread_mutex_unlock(&aio.lock);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioStart
+// Description  : sets up an empty ring and starts the I/O thread
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int aioStart()
+{
+    uint32_t i;
+
+    if(aio.on)
+        return(0);
+    for(i=0;i<AIO_RING;i++)
+        aio.seq[i]=i;
+    aio.head=aio.tail=0;
+    aio.submitted=aio.taken=aio.finished=0;
+    if(sem_init(&aio.ready,0,0)==-1 || pthread_mutex_init(&aio.lock,NULL)!=0 ||
+       pthread_cond_init(&aio.done,NULL)!=0 || pthread_create(&aio.thread,NULL,aioThread,NULL)!=0)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Error @aioStart I/O thread did not start");
+        return(-1);
+    }
+    __atomic_store_n(&aio.on,1,__ATOMIC_RELEASE);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioStop
+// Description  : stops the I/O thread once every request in the ring is done,
+//                the stop closes the ring so a submit racing it fails
+//
+// Inputs       : none
+// Outputs      : none
+//
+void aioStop()
+{
+    if(!aio.on)
+        return;
+    while(aioPut(NULL)==-1)
+        sched_yield();//full, the I/O thread is making room
+    __atomic_store_n(&aio.on,0,__ATOMIC_RELEASE);//closed, no new requests
+    pthread_join(aio.thread,NULL);
+    pthread_cond_destroy(&aio.done);
+    pthread_mutex_destroy(&aio.lock);
+    sem_destroy(&aio.ready);
+    logMessage(LOG_INFO_LEVEL,"CART driver: %u async requests done",aio.finished);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : aioDrain
+// Description  : waits for every queued request to finish, the other calls
+//                do this first so they never run alongside the I/O thread
+//                and see what was queued before them. A done callback on the
+//                I/O thread does not wait on itself
+//
+// Inputs       : none
+// Outputs      : none
+//
+void aioDrain()
+{
+    if(!__atomic_load_n(&aio.on,__ATOMIC_ACQUIRE) || pthread_equal(pthread_self(),aio.thread))
+        return;
+    if(__atomic_load_n(&aio.finished,__ATOMIC_ACQUIRE)==__atomic_load_n(&aio.submitted,__ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&aio.lock);
+    while(__atomic_load_n(&aio.finished,__ATOMIC_ACQUIRE)!=__atomic_load_n(&aio.submitted,__ATOMIC_ACQUIRE))
+        pthread_cond_wait(&aio.done,&aio.lock);
+    pthread_mutex_unlock(&aio.lock);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverFill
+// Description  : fills a test buffer with bytes that differ per seed and
+//                per frame, so a frame read from the wrong place shows
+//
+// Inputs       : buf - the buffer
+//                n - bytes
+//                seed - picks the pattern
+// Outputs      : none
+//
+void driverFill(char* buf, uint32_t n, uint32_t seed)
+{
+    uint32_t i;
+
+    for(i=0;i<n;i++)
+        buf[i]=(char)(seed*131+i/CART_FRAME_SIZE*7+i);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverCheck
+// Description  : logs a failed check of the driver unit test
+//
+// Inputs       : ok - the check passed
+//                what - what was checked
+// Outputs      : 0 if it passed, -1 if not
+//
+int driverCheck(int ok, const char* what)
+{
+    if(ok)
+        return(0);
+    logMessage(LOG_ERROR_LEVEL,"Driver unit test failed: %s",what);
+    return(-1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverFreeFrames
+// Description  : counts the free frames of the formatted carts
+//
+// Inputs       : none
+// Outputs      : the count
+//
+uint32_t driverFreeFrames()
+{
+    uint32_t frames=0;
+    uint16_t c;
+
+    for(c=0;c<CART_MAX_CARTRIDGES;c++)
+        if(cartFormatted(c))
+            frames+=tab.cFree[c];
+    return(frames);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverIoTest
+// Description  : pread/pwrite, readv/writev across frames, short reads at
+//                the end of the file and truncate then read
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverIoTest()
+{
+    char w[DRV_TEST_BYTES], r[DRV_TEST_BYTES];
+    struct iovec v[3];
+    int16_t fd=cart_open("utest/io");
+
+    if(driverCheck(fd!=-1,"open utest/io"))
+        return(-1);
+
+    //a 100 byte file gives back what it has and no more
+    driverFill(w,DRV_TEST_BYTES,1);
+    if(driverCheck(cart_pwrite(fd,w,100,0)==100,"pwrite 100 bytes") ||
+       driverCheck(cart_pread(fd,r,3000,50)==50 && !memcmp(r,w+50,50),"pread past the end is short") ||
+       driverCheck(cart_pread(fd,r,10,100)==0,"pread at the end reads nothing") ||
+       driverCheck(cart_pread(fd,r,10,101)==-1,"pread past the end fails"))
+        return(-1);
+
+    //writev over frame edges, then readv with different edges
+    v[0].iov_base=w;       v[0].iov_len=1000;
+    v[1].iov_base=w+1000;  v[1].iov_len=2500;
+    v[2].iov_base=w+3500;  v[2].iov_len=DRV_TEST_BYTES-3500;
+    if(driverCheck(cart_seek(fd,0)==0 && cart_writev(fd,v,3)==DRV_TEST_BYTES,"writev across frames"))
+        return(-1);
+    memset(r,0,sizeof(r));
+    v[0].iov_base=r;       v[0].iov_len=1024;
+    v[1].iov_base=r+1024;  v[1].iov_len=7;
+    v[2].iov_base=r+1031;  v[2].iov_len=DRV_TEST_BYTES;//more than is left
+    if(driverCheck(cart_seek(fd,0)==0 && cart_readv(fd,v,3)==DRV_TEST_BYTES && !memcmp(r,w,DRV_TEST_BYTES),"readv across frames") ||
+       driverCheck(cart_read(fd,r,10)==0,"read at the end reads nothing"))
+        return(-1);
+
+    //pwrite in the middle leaves the position alone
+    driverFill(w+2000,1500,2);
+    memset(r,0,sizeof(r));
+    if(driverCheck(cart_seek(fd,10)==0 && cart_pwrite(fd,w+2000,1500,2000)==1500,"pwrite in the middle") ||
+       driverCheck(cart_read(fd,r,10)==10 && !memcmp(r,w+10,10),"pwrite moved the position") ||
+       driverCheck(cart_pread(fd,r,DRV_TEST_BYTES,0)==DRV_TEST_BYTES && !memcmp(r,w,DRV_TEST_BYTES),"pread of the whole file"))
+        return(-1);
+
+    //truncate, the bytes past the cut are gone
+    memset(r,0,sizeof(r));
+    if(driverCheck(cart_truncate(fd,1500)==0,"truncate to 1500") ||
+       driverCheck(cart_seek(fd,0)==0 && cart_read(fd,r,DRV_TEST_BYTES)==1500 && !memcmp(r,w,1500),"read after truncate") ||
+       driverCheck(cart_pread(fd,r,10,1500)==0,"pread at the cut reads nothing") ||
+       driverCheck(cart_seek(fd,1501)==-1,"seek past the cut"))
+        return(-1);
+
+    if(driverCheck(cart_close(fd)==0 && cart_delete("utest/io")==0,"close and delete utest/io"))
+        return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverReuseTest
+// Description  : a deleted file's frames go to the next file, with none of
+//                the old file's bytes showing through
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverReuseTest()
+{
+    char w[DRV_TEST_BYTES], r[DRV_TEST_BYTES];
+    uint32_t before;
+    int16_t fd;
+    int i;
+
+    fd=cart_open("utest/old");
+    driverFill(w,DRV_TEST_BYTES,3);
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+        if(driverCheck(cart_write(fd,w,DRV_TEST_BYTES)==DRV_TEST_BYTES,"write utest/old"))
+            return(-1);
+    if(driverCheck(cart_close(fd)==0,"close utest/old"))
+        return(-1);
+    before=driverFreeFrames();
+
+    fd=cart_open("utest/old");
+    if(driverCheck(cart_delete("utest/old")==-1,"delete of an open file") ||
+       driverCheck(cart_close(fd)==0 && cart_delete("utest/old")==0,"delete utest/old"))
+        return(-1);
+
+    //the name is free again, and makes a new empty file
+    fd=cart_open("utest/old");
+    if(driverCheck(fd!=-1 && cart_read(fd,r,DRV_TEST_BYTES)==0,"reopen of a deleted file is empty") ||
+       driverCheck(cart_close(fd)==0 && cart_delete("utest/old")==0,"delete utest/old again"))
+        return(-1);
+
+    fd=cart_open("utest/new");
+    driverFill(w,DRV_TEST_BYTES,4);
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+        if(driverCheck(cart_write(fd,w,DRV_TEST_BYTES)==DRV_TEST_BYTES,"write utest/new"))
+            return(-1);
+    if(driverCheck(cart_close(fd)==0,"close utest/new") ||
+       driverCheck(driverFreeFrames()==before,"frames of a deleted file reused"))
+        return(-1);
+
+    fd=cart_open("utest/new");
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+    {
+        memset(r,0,sizeof(r));
+        if(driverCheck(cart_read(fd,r,DRV_TEST_BYTES)==DRV_TEST_BYTES && !memcmp(r,w,DRV_TEST_BYTES),"read utest/new"))
+            return(-1);
+    }
+    if(driverCheck(cart_close(fd)==0 && cart_delete("utest/new")==0,"close and delete utest/new"))
+        return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverDirTest
+// Description  : mkdir/readdir/rmdir, a directory lists what is in it and
+//                is only removed once it is empty
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverDirTest()
+{
+    char name[CART_MAX_PATH_LENGTH];
+    int32_t cookie=0, seen=0;
+    int16_t fd;
+
+    if(driverCheck(cart_mkdir("utest/d")==0,"mkdir utest/d") ||
+       driverCheck(cart_mkdir("utest/d")==-1,"mkdir of a directory that is there") ||
+       driverCheck(cart_mkdir("utest/none/d")==-1,"mkdir in a missing directory") ||
+       driverCheck(cart_open("utest/none/f")==-1,"open in a missing directory") ||
+       driverCheck(cart_mkdir("utest/d/e")==0,"mkdir utest/d/e"))
+        return(-1);
+    fd=cart_open("utest/d/f");
+    if(driverCheck(fd!=-1 && cart_close(fd)==0,"create utest/d/f"))
+        return(-1);
+
+    while(cart_readdir("utest/d",&cookie,name)==1)
+    {
+        if(!strcmp(name,"e/"))
+            seen|=1;
+        else if(!strcmp(name,"f"))
+            seen|=2;
+        else
+            seen|=4;
+    }
+    if(driverCheck(seen==3,"readdir utest/d lists e/ and f") ||
+       driverCheck(cart_readdir("utest/d/f",&cookie,name)==-1,"readdir of a file") ||
+       driverCheck(cart_rmdir("utest/d")==-1,"rmdir of a directory that is not empty") ||
+       driverCheck(cart_delete("utest/d/f")==0 && cart_rmdir("utest/d/e")==0,"empty utest/d") ||
+       driverCheck(cart_rmdir("utest/d")==0,"rmdir utest/d"))
+        return(-1);
+
+    cookie=0;
+    while(cart_readdir("utest",&cookie,name)==1)
+        if(driverCheck(strcmp(name,"d/")!=0,"readdir lists a removed directory"))
+            return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverShareTest
+// Description  : several descriptors on one file each have their own
+//                position and see each other's writes
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverShareTest()
+{
+    char w[DRV_TEST_BYTES], r[DRV_TEST_BYTES];
+    int16_t a=cart_open("utest/share"), b=cart_open("utest/share"), c;
+
+    if(driverCheck(a!=-1 && b!=-1 && a!=b,"two descriptors on utest/share"))
+        return(-1);
+
+    driverFill(w,DRV_TEST_BYTES,5);
+    memset(r,0,sizeof(r));
+    if(driverCheck(cart_write(a,w,DRV_TEST_BYTES)==DRV_TEST_BYTES,"write through the first") ||
+       driverCheck(cart_read(b,r,1500)==1500 && !memcmp(r,w,1500),"read through the second") ||
+       driverCheck(cart_read(b,r,DRV_TEST_BYTES)==DRV_TEST_BYTES-1500 && !memcmp(r,w+1500,DRV_TEST_BYTES-1500),"second keeps its own position"))
+        return(-1);
+
+    //a write through one is read through the other, and closing one leaves the other
+    driverFill(w+100,200,6);
+    c=cart_open("utest/share");
+    if(driverCheck(c!=-1 && cart_pwrite(b,w+100,200,100)==200,"pwrite through the second") ||
+       driverCheck(cart_close(b)==0 && cart_close(b)==-1,"close the second once") ||
+       driverCheck(cart_pread(a,r,DRV_TEST_BYTES,0)==DRV_TEST_BYTES && !memcmp(r,w,DRV_TEST_BYTES),"first sees the second's write") ||
+       driverCheck(cart_read(c,r,300)==300 && !memcmp(r,w,300),"third sees the second's write"))
+        return(-1);
+
+    if(driverCheck(cart_close(a)==0 && cart_close(c)==0,"close utest/share") ||
+       driverCheck(cart_read(a,r,1)==-1 && cart_seek(c,0)==-1,"closed descriptors refused") ||
+       driverCheck(cart_delete("utest/share")==0,"delete utest/share"))
+        return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverMountTest
+// Description  : files and directories come back the same after a power off
+//                and power on
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverMountTest()
+{
+    char w[DRV_TEST_BYTES], r[DRV_TEST_BYTES], name[CART_MAX_PATH_LENGTH];
+    int32_t cookie=0;
+    int16_t fd;
+
+    driverFill(w,DRV_TEST_BYTES,7);
+    if(driverCheck(cart_mkdir("utest/m")==0,"mkdir utest/m") ||
+       driverCheck((fd=cart_open("utest/m/kept"))!=-1 && cart_write(fd,w,DRV_TEST_BYTES-3)==DRV_TEST_BYTES-3,"write utest/m/kept") ||
+       driverCheck(cart_poweroff()==0,"power off with a file open") ||
+       driverCheck(cart_poweron()==0,"power on again"))
+        return(-1);
+
+    memset(r,0,sizeof(r));
+    fd=cart_open("utest/m/kept");
+    if(driverCheck(cart_readdir("utest/m",&cookie,name)==1 && !strcmp(name,"kept"),"readdir after power on") ||
+       driverCheck(fd!=-1 && cart_read(fd,r,DRV_TEST_BYTES)==DRV_TEST_BYTES-3 && !memcmp(r,w,DRV_TEST_BYTES-3),"read after power on") ||
+       driverCheck(cart_close(fd)==0 && cart_delete("utest/m/kept")==0 && cart_rmdir("utest/m")==0,"remove utest/m"))
+        return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverAioDone
+// Description  : completion callback of the async test, counts finishes
+//
+// Inputs       : req - the finished request
+// Outputs      : none
+//
+void driverAioDone(CartAio* req)
+{
+    __atomic_add_fetch((int32_t*)req->data,1,__ATOMIC_RELAXED);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverAioHeld
+// Description  : completion callback that holds the I/O thread until the
+//                test posts driverHold, so the requests stay queued
+//
+// Inputs       : req - the finished request
+// Outputs      : none
+//
+void driverAioHeld(CartAio* req)
+{
+    while(sem_wait(&driverHold)==-1);//interrupted, go back
+    driverAioDone(req);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverAioTest
+// Description  : async writes then reads of one file, finishing in order,
+//                with a short read at the end and a bad handle failing
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int driverAioTest()
+{
+    char w[DRV_TEST_BYTES], r[DRV_TEST_BYTES];
+    CartAio req[DRV_TEST_ROUNDS+1];
+    int32_t called=0, i, step=DRV_TEST_BYTES/DRV_TEST_ROUNDS;
+    int16_t fd=cart_open("utest/aio");
+    int ret;
+
+    if(driverCheck(fd!=-1,"open utest/aio"))
+        return(-1);
+
+    //each write starts at the end the one before it leaves, the first holds
+    //the I/O thread in its callback so every one of them is still queued
+    driverFill(w,DRV_TEST_BYTES,8);
+    memset(req,0,sizeof(req));
+    sem_init(&driverHold,0,0);
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+    {
+        req[i].fd=fd;
+        req[i].buf=w+i*step;
+        req[i].count=step;
+        req[i].offset=i*step;
+        req[i].done=(i==0) ? driverAioHeld : driverAioDone;
+        req[i].data=&called;
+        if(cart_aio_write(&req[i])!=0)
+            break;
+    }
+    ret=(i==DRV_TEST_ROUNDS) ? 0 : driverCheck(0,"queue an async write");
+    if(ret==0)
+        ret=driverCheck(cart_aio_write(&req[0])==-1 && cart_aio_write(&req[DRV_TEST_ROUNDS-1])==-1,"queue a request that is queued already");
+    sem_post(&driverHold);
+    if(ret)
+        return(-1);
+
+    //a call made while they are queued waits for them, and sees what they wrote
+    memset(r,0,sizeof(r));
+    if(driverCheck(cart_pread(fd,r,DRV_TEST_BYTES,0)==DRV_TEST_ROUNDS*step && !memcmp(r,w,DRV_TEST_ROUNDS*step),"pread after queued writes"))
+        return(-1);
+    for(i=DRV_TEST_ROUNDS-1;i>=0;i--)
+        if(driverCheck(cart_aio_wait(&req[i])==step,"async write"))
+            return(-1);
+    sem_destroy(&driverHold);
+    if(driverCheck(cart_aio_poll(&req[0])==1 && called==DRV_TEST_ROUNDS,"every write finished and called back"))
+        return(-1);
+
+    //the reads, the last one asks for more than the file has
+    memset(r,0,sizeof(r));
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+    {
+        req[i].buf=r+i*step;
+        req[i].done=NULL;
+        req[i].count=(i==DRV_TEST_ROUNDS-1) ? DRV_TEST_BYTES-i*step : step;
+        if(driverCheck(cart_aio_read(&req[i])==0,"queue an async read"))
+            return(-1);
+    }
+    req[i].fd=-1;
+    req[i].buf=r;
+    req[i].count=1;
+    if(driverCheck(cart_aio_read(&req[i])==0 && cart_aio_wait(&req[i])==-1,"async read of a bad handle fails"))
+        return(-1);
+    for(i=0;i<DRV_TEST_ROUNDS;i++)
+        if(driverCheck(cart_aio_poll(&req[i])==1,"requests finish in the order they were queued"))
+            return(-1);
+    if(driverCheck(req[DRV_TEST_ROUNDS-1].result==step && !memcmp(r,w,DRV_TEST_ROUNDS*step),"async reads"))
+        return(-1);
+
+    if(driverCheck(cart_close(fd)==0 && cart_delete("utest/aio")==0,"close and delete utest/aio"))
+        return(-1);
+    return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartDriverUnitTest
+// Description  : Run a UNIT test of the driver against the cart server, in
+//                a directory of its own that it removes after
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+//
+int cartDriverUnitTest(void)
+{
+    int ret;
+
+    if(cart_poweron()!=0)
+    {
+        logMessage(LOG_ERROR_LEVEL,"Driver unit test failed: power on");
+        return(-1);
+    }
+    if(driverCheck(cart_mkdir("utest")==0,"mkdir utest, remove it if an earlier run left it"))
+    {
+        cart_poweroff();
+        return(-1);
+    }
+
+    ret=(driverIoTest() || driverReuseTest() || driverDirTest() || driverShareTest() ||
+         driverMountTest() || driverAioTest()) ? -1 : 0;
+    if(ret==0)
+        ret=driverCheck(cart_rmdir("utest")==0,"rmdir utest");
+    if(cart_poweroff()!=0)
+        ret=-1;
+    if(ret)
+        return(-1);
+
+    // Return successfully
+    logMessage(LOG_OUTPUT_LEVEL,"Driver unit test completed successfully.");
+    return(0);
 }
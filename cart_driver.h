@@ -13,12 +13,27 @@
 
 // Include files
 #include <stdint.h>
+#include <sys/uio.h>
 #include <cart_controller.h>
 
 // Defines
-#define CART_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define CART_MAX_PATH_LENGTH 128 // Maximum length of filename length
 
+// Type definitions
+
+// An asynchronous read or write, the driver's from submit until it finishes
+typedef struct CartAio {
+	int16_t   fd;      // file handle
+	void     *buf;     // bytes to read into or write from
+	int32_t   count;   // number of bytes
+	uint32_t  offset;  // where in the file, the file position does not move
+	void    (*done)(struct CartAio *req); // called from the I/O thread when finished, or NULL
+	void     *data;    // the caller's
+	int32_t   result;  // bytes moved or -1, once finished
+	int32_t   state;   // driver's
+	int8_t    write;   // driver's
+} CartAio;
+
 //
 // Interface functions
 
@@ -43,6 +58,50 @@ int32_t cart_write(int16_t fd, void *buf, int32_t count);
 int32_t cart_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t offset);
+	// Reads "count" bytes at "offset" into "buf", the file position does not move
+
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t offset);
+	// Writes "count" bytes from "buf" at "offset", the file position does not move
+
+int32_t cart_readv(int16_t fd, const struct iovec *iov, int iovcnt);
+	// Reads into each buffer of "iov" in turn, from the file position
+
+int32_t cart_writev(int16_t fd, const struct iovec *iov, int iovcnt);
+	// Writes each buffer of "iov" in turn, at the file position
+
+int32_t cart_mkdir(char *path);
+	// Make a directory, the directory it goes in must exist
+
+int32_t cart_readdir(char *path, int32_t *cookie, char *name);
+	// List a directory, one entry into name per call (1, or 0 at the end)
+
+int32_t cart_delete(char *path);
+	// Remove a closed file, its frames go back to the carts
+
+int32_t cart_truncate(int16_t fd, uint32_t length);
+	// Cut an open file down to length bytes, the frames past it go back to the carts
+
+int32_t cart_rmdir(char *path);
+	// Remove an empty directory
+
+// Requests finish in the order they were queued, one at a time on an I/O
+// thread. The other calls wait for the queued requests to finish first
+int32_t cart_aio_read(CartAio *req);
+	// Queue a read like cart_pread for the I/O thread, returns at once
+
+int32_t cart_aio_write(CartAio *req);
+	// Queue a write like cart_pwrite for the I/O thread, returns at once
+
+int32_t cart_aio_poll(CartAio *req);
+	// Returns 1 if a queued request has finished, 0 if not yet
+
+int32_t cart_aio_wait(CartAio *req);
+	// Waits for a queued request to finish, returns its result
+
+int cartDriverUnitTest(void);
+	// Run a UNIT test of the driver, against a running cart server
+
 //helper functions for cart communication
 int16_t CNF(uint16_t n);
 int16_t FNF(uint16_t n);
@@ -59,9 +118,10 @@ int initCache();
 int initCart();
 int zeroCart();
 int powerOff();
-int16_t findFile(char* path);
+int32_t findFile(char* path);
 int32_t writer(uint16_t cart, uint16_t frame, void* buf);
 int32_t reader(uint16_t cart, uint16_t frame, void* buf);
+int flushFrame(uint32_t file_num, void* buf);
 
 
 
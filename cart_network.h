@@ -20,11 +20,17 @@
 #define CART_NET_HEADER_SIZE sizeof(CartXferRegister)
 #define CART_DEFAULT_IP "127.0.0.1"
 #define CART_DEFAULT_PORT 21785
+#define CART_DEFAULT_WINDOW 16 // requests in flight at most, unless set
+#define CART_MAX_WINDOW 64
+#define CART_WINDOW_BYTES (64 * (CART_NET_HEADER_SIZE + CART_FRAME_SIZE)) // response bytes in flight at most
+#define CART_STAGE_BYTES (2 * CART_WINDOW_BYTES) // client send and receive buffers, each
 
 // Global data
 extern int            cart_network_shutdown; // Flag indicating shutdown
 extern unsigned char *cart_network_address;  // Address of CART server
 extern unsigned short cart_network_port;     // Port of CART server
+extern int            cart_network_window;   // Requests in flight at most
+extern int            cart_network_uring;    // 0 keeps the client off io_uring
 
 //
 // Functional Prototypes
@@ -32,6 +38,18 @@ extern unsigned short cart_network_port;     // Port of CART server
 CartXferRegister cart_client_bus_request(CartXferRegister reg, void *buf);
 	// This is the implementation of the client operation (cart_client.c)
 
+int cart_client_bus_submit(CartXferRegister reg, void *buf);
+	// Sends a request without waiting for its response (cart_client.c)
+
+CartXferRegister cart_client_bus_complete(void);
+	// Reads the response to the oldest request in flight (cart_client.c)
+
+int cart_client_bus_room(CartXferRegister reg);
+	// Says if a request fits in the window now (cart_client.c)
+
+int cart_client_bus_pending(void);
+	// Returns the number of requests in flight (cart_client.c)
+
 int cart_server( void );
 	// This is the implementation of the server application (cart_server.c)
 
@@ -0,0 +1,817 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_server.c
+//  Description    : This is the server side of the CART communication
+//                   protocol, a stand-in for the prebuilt cart_server. One
+//                   epoll loop serves every client connection, and each
+//                   connection has a memory system of its own, so several
+//                   clients can run at once on one machine.
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_SERVER_ARGUMENTS "hvnl:p:"
+#define CART_SERVER_BACKING "cart_memsys.bck"
+#define CART_SERVER_EVENTS 64 // epoll events taken per wait
+#define CART_SERVER_READ (64*1024) // most bytes read from a client at a time
+#define CART_SERVER_OUT_MAX (256*1024) // replies held for a client before it is not read from
+#define CART_SERVER_CART_BYTES (CART_CARTRIDGE_SIZE*CART_FRAME_SIZE)
+#define USAGE \
+	"USAGE: cart_server_epoll [-h] [-v] [-n] [-l <logfile>] [-p <port>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -n - no backing store, memory is not read at INITMS or kept at POWOFF\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number of server to listen on.\n" \
+	"\n" \
+
+// A client's memory system, cartridges get memory on their first write
+typedef struct {
+	int            on;                         // INITMS done and no POWOFF since
+	CartridgeIndex loaded;                     // loaded cartridge, CART_NO_CARTRIDGE for none
+	char          *carts[CART_MAX_CARTRIDGES]; // cartridge memory, NULL reads as zeros
+	unsigned long  ops[CART_OP_MAXVAL];        // operations done, by opcode
+} CartMemorySystem;
+
+// Bytes waiting, requests in or replies out
+typedef struct {
+	char     *b;     // the bytes
+	uint32_t  start; // first byte not used yet
+	uint32_t  len;   // bytes from start
+	uint32_t  cap;   // bytes allocated
+} CartBuffer;
+
+// A client connection
+typedef struct {
+	int              sock;      // the client's socket
+	char             peer[32];  // address/port, for the log
+	uint32_t         events;    // epoll events asked for
+	CartBuffer       in, out;   // requests read, replies not sent yet
+	CartMemorySystem mem;       // the client's cartridges
+} CartConnection;
+
+//
+// Global Data
+int            cart_network_shutdown = 0;    // Flag indicating shutdown
+unsigned char *cart_network_address = NULL;  // Address of CART server
+unsigned short cart_network_port = 0;        // Port of CART server
+unsigned long  CartControllerLLevel = 0;     // Controller log level
+unsigned long  CartDriverLLevel = 0;         // Driver log level
+unsigned long  CartSimulatorLLevel = 0;      // Simulator log level
+int backing = 1;                             // read and write the backing store
+int epoll_handle = -1;                       // the event loop
+
+//
+// Functional Prototypes
+
+void shutdown_handler(int sig);                                    // stop the server
+int accept_clients(int server);                                    // take new connections
+void close_client(CartConnection *conn);                           // drop a connection
+int read_client(CartConnection *conn);                             // read requests
+int write_client(CartConnection *conn);                            // send replies
+int process_requests(CartConnection *conn);                        // run the requests read
+int update_events(CartConnection *conn);                           // ask for the events needed
+int buffer_reserve(CartBuffer *buf, uint32_t n);                   // room for n more bytes
+void buffer_consume(CartBuffer *buf, uint32_t n);                  // drop n bytes from the front
+CartXferRegister cart_execute(CartMemorySystem *mem, CartXferRegister reg, char *frame); // do one operation
+int cart_load_backing(CartMemorySystem *mem);                      // memory from the backing store
+int cart_save_backing(CartMemorySystem *mem);                      // memory to the backing store
+void cart_release(CartMemorySystem *mem);                          // free the cartridges
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+	struct sigaction sa;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_SERVER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'n': // No backing store
+			backing = 0;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &cart_network_port) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Stop cleanly on a signal, and a client going away is not one
+	memset( &sa, 0, sizeof(sa) );
+	sa.sa_handler = shutdown_handler;
+	sigaction( SIGINT, &sa, NULL );
+	sigaction( SIGTERM, &sa, NULL );
+	signal( SIGPIPE, SIG_IGN );
+
+	// Run the server
+	if ( cart_server() != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART server failed, aborting." );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shutdown_handler
+// Description  : Ask the event loop to stop
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+void shutdown_handler(int sig) {
+	cart_network_shutdown = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_server
+// Description  : The server loop, listens for clients and runs their
+//                requests as they come in. Every socket is non-blocking and
+//                watched by one epoll handle, a connection's state lives in
+//                its CartConnection
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_server( void ) {
+
+	// Local variables
+	struct epoll_event ev, events[CART_SERVER_EVENTS];
+	struct sockaddr_in saddr;
+	CartConnection *conn;
+	int server, n, i, one = 1;
+
+	// Create the listening socket
+	if ( (server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART socket() create failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	if ( setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART set socket option create failed : [%s]", strerror(errno) );
+		close( server );
+		return( -1 );
+	}
+	memset( &saddr, 0, sizeof(saddr) );
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons( (cart_network_port != 0) ? cart_network_port : CART_DEFAULT_PORT );
+	saddr.sin_addr.s_addr = htonl( INADDR_ANY );
+	if ( bind(server, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART bind() create failed : [%s]", strerror(errno) );
+		close( server );
+		return( -1 );
+	}
+	if ( listen(server, SOMAXCONN) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART listen() create failed : [%s]", strerror(errno) );
+		close( server );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "Server bound and listening on port [%d]", ntohs(saddr.sin_port) );
+
+	// The event loop, the listener has a NULL pointer and clients their connection
+	if ( (epoll_handle = epoll_create1(0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART epoll_create1() failed : [%s]", strerror(errno) );
+		close( server );
+		return( -1 );
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl( epoll_handle, EPOLL_CTL_ADD, server, &ev );
+
+	while ( ! cart_network_shutdown ) {
+
+		if ( (n = epoll_wait(epoll_handle, events, CART_SERVER_EVENTS, -1)) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "CART server wait failed, aborting." );
+			break;
+		}
+
+		for ( i=0; i<n; i++ ) {
+
+			// A new client
+			conn = events[i].data.ptr;
+			if ( conn == NULL ) {
+				accept_clients( server );
+				continue;
+			}
+
+			// Requests in, replies out, then whatever the connection needs next
+			if ( (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN) ) {
+				close_client( conn );
+				continue;
+			}
+			if ( (events[i].events & EPOLLIN) && (read_client(conn) == -1) ) {
+				close_client( conn );
+				continue;
+			}
+			if ( (process_requests(conn) == -1) || (write_client(conn) == -1) ||
+			     (process_requests(conn) == -1) || (update_events(conn) == -1) ) {
+				close_client( conn );
+			}
+		}
+	}
+
+	// Shut down, clients still connected lose their memory systems
+	logMessage( LOG_INFO_LEVEL, "Shutting down CART server ..." );
+	close( epoll_handle );
+	close( server );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : accept_clients
+// Description  : Take every connection waiting on the listener
+//
+// Inputs       : server - the listening socket
+// Outputs      : 0 if successful, -1 if failure
+
+int accept_clients(int server) {
+
+	// Local variables
+	struct sockaddr_in caddr;
+	socklen_t len = sizeof(caddr);
+	struct epoll_event ev;
+	CartConnection *conn;
+	int sock, one = 1;
+
+	while ( (sock = accept(server, (struct sockaddr *)&caddr, &len)) != -1 ) {
+
+		// Non-blocking like the listener, and replies go out as soon as they are made
+		fcntl( sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK );
+		setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+
+		if ( (conn = calloc(1, sizeof(CartConnection))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "CART server out of memory for a connection." );
+			close( sock );
+			continue;
+		}
+		conn->sock = sock;
+		conn->mem.loaded = CART_NO_CARTRIDGE;
+		snprintf( conn->peer, sizeof(conn->peer), "%s/%d", inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port) );
+
+		ev.events = conn->events = EPOLLIN;
+		ev.data.ptr = conn;
+		if ( epoll_ctl(epoll_handle, EPOLL_CTL_ADD, sock, &ev) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "CART server accept failed : [%s]", strerror(errno) );
+			close( sock );
+			free( conn );
+			continue;
+		}
+		logMessage( LOG_INFO_LEVEL, "Server new client connection [%s]", conn->peer );
+		len = sizeof(caddr);
+	}
+
+	if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) ) {
+		logMessage( LOG_ERROR_LEVEL, "CART server accept failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_client
+// Description  : Drop a connection and everything it holds
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void close_client(CartConnection *conn) {
+	logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->peer );
+	epoll_ctl( epoll_handle, EPOLL_CTL_DEL, conn->sock, NULL );
+	close( conn->sock );
+	cart_release( &conn->mem );
+	free( conn->in.b );
+	free( conn->out.b );
+	free( conn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_client
+// Description  : Read what the client has sent, up to CART_SERVER_READ bytes
+//                a call so one busy client does not hold up the rest
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is done
+
+int read_client(CartConnection *conn) {
+
+	// Local variables
+	ssize_t got;
+	int one = 1;
+
+	if ( buffer_reserve(&conn->in, CART_SERVER_READ) == -1 ) {
+		return( -1 );
+	}
+	got = recv( conn->sock, conn->in.b+conn->in.start+conn->in.len, CART_SERVER_READ, 0 );
+	if ( got == 0 ) {
+		return( -1 );
+	}
+	if ( got == -1 ) {
+		if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) {
+			return( 0 );
+		}
+		logMessage( LOG_ERROR_LEVEL, "CART receive failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	conn->in.len += got;
+
+	// A client sending a header and its frame in two writes waits on our ack
+	setsockopt( conn->sock, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one) );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : process_requests
+// Description  : Run every whole request read so far, in order, queueing the
+//                replies. Stops while too many replies wait to go out, the
+//                rest runs once the client reads them
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int process_requests(CartConnection *conn) {
+
+	// Local variables
+	CartXferRegister reg, net;
+	uint32_t need, frames;
+	char *req, *reply;
+	uint8_t op;
+
+	while ( (conn->in.len >= CART_NET_HEADER_SIZE) && (conn->out.len < CART_SERVER_OUT_MAX) ) {
+
+		// Whole request, a write carries its frames
+		req = conn->in.b+conn->in.start;
+		memcpy( &net, req, sizeof(net) );
+		reg = ntohll64( net );
+		op = (uint8_t)(reg >> 56);
+		frames = ( (op == CART_OP_RDFRME) || (op == CART_OP_WRFRME) ) ? 1 :
+		         ( (op == CART_OP_RDFRMS) || (op == CART_OP_WRFRMS) ) ? (uint32_t)(reg & CART_FC1_MASK) : 0;
+		need = CART_NET_HEADER_SIZE + ( ((op == CART_OP_WRFRME) || (op == CART_OP_WRFRMS)) ? frames*CART_FRAME_SIZE : 0 );
+		if ( conn->in.len < need ) {
+			if ( buffer_reserve(&conn->in, need) == -1 ) {
+				return( -1 );
+			}
+			break;
+		}
+
+		// Run it, a read sends back its frames
+		if ( buffer_reserve(&conn->out, CART_NET_HEADER_SIZE+frames*CART_FRAME_SIZE) == -1 ) {
+			return( -1 );
+		}
+		reply = conn->out.b+conn->out.start+conn->out.len;
+		if ( (op == CART_OP_RDFRME) || (op == CART_OP_RDFRMS) ) {
+			reg = cart_execute( &conn->mem, reg, reply+CART_NET_HEADER_SIZE );
+		} else {
+			reg = cart_execute( &conn->mem, reg, req+CART_NET_HEADER_SIZE );
+		}
+		net = htonll64( reg );
+		memcpy( reply, &net, sizeof(net) );
+		conn->out.len += CART_NET_HEADER_SIZE;
+		if ( (op == CART_OP_RDFRME) || ((op == CART_OP_RDFRMS) && !((reg >> 47) & 1)) ) {
+			conn->out.len += frames*CART_FRAME_SIZE;
+		}
+		buffer_consume( &conn->in, need );
+	}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_client
+// Description  : Send the replies waiting, as far as the socket takes them
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is done
+
+int write_client(CartConnection *conn) {
+
+	// Local variables
+	ssize_t sent;
+
+	while ( conn->out.len > 0 ) {
+		sent = send( conn->sock, conn->out.b+conn->out.start, conn->out.len, MSG_NOSIGNAL );
+		if ( sent == -1 ) {
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+				return( 0 );
+			}
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "CART send failed : [%s]", strerror(errno) );
+			return( -1 );
+		}
+		buffer_consume( &conn->out, sent );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : update_events
+// Description  : Ask epoll for what the connection can do next, reading
+//                while its replies fit and writing while any are left
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int update_events(CartConnection *conn) {
+
+	// Local variables
+	struct epoll_event ev;
+	uint32_t want = 0;
+
+	if ( conn->out.len < CART_SERVER_OUT_MAX ) {
+		want |= EPOLLIN;
+	}
+	if ( conn->out.len > 0 ) {
+		want |= EPOLLOUT;
+	}
+	if ( want == conn->events ) {
+		return( 0 );
+	}
+
+	ev.events = conn->events = want;
+	ev.data.ptr = conn;
+	if ( epoll_ctl(epoll_handle, EPOLL_CTL_MOD, conn->sock, &ev) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CART epoll_ctl() failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buffer_reserve
+// Description  : Make room for n more bytes after the ones waiting, moving
+//                them to the front or growing the buffer
+//
+// Inputs       : buf - the buffer
+//                n - bytes needed
+// Outputs      : 0 if successful, -1 if failure
+
+int buffer_reserve(CartBuffer *buf, uint32_t n) {
+
+	// Local variables
+	uint32_t cap;
+	char *grown;
+
+	if ( buf->start+buf->len+n <= buf->cap ) {
+		return( 0 );
+	}
+	if ( buf->start > 0 ) {
+		memmove( buf->b, buf->b+buf->start, buf->len );
+		buf->start = 0;
+		if ( buf->len+n <= buf->cap ) {
+			return( 0 );
+		}
+	}
+
+	for ( cap=(buf->cap>0) ? buf->cap : CART_SERVER_READ; cap<buf->len+n; cap*=2 );
+	if ( (grown = realloc(buf->b, cap)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CART server out of memory for a buffer of %u bytes.", cap );
+		return( -1 );
+	}
+	buf->b = grown;
+	buf->cap = cap;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buffer_consume
+// Description  : Drop bytes from the front of a buffer
+//
+// Inputs       : buf - the buffer
+//                n - bytes done with
+// Outputs      : none
+
+void buffer_consume(CartBuffer *buf, uint32_t n) {
+	buf->start += n;
+	buf->len -= n;
+	if ( buf->len == 0 ) {
+		buf->start = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_execute
+// Description  : Run one operation on a client's memory system. The reply
+//                is the request register with RT1 set on failure
+//
+// Inputs       : mem - the memory system
+//                reg - the request register
+//                frame - the frame written, or the frame read goes here
+// Outputs      : the reply register
+
+CartXferRegister cart_execute(CartMemorySystem *mem, CartXferRegister reg, char *frame) {
+
+	// Local variables
+	uint8_t op = (uint8_t)(reg >> 56);
+	uint16_t ct1 = (uint16_t)((reg >> 31) & 0xffff);
+	uint16_t fm1 = (uint16_t)((reg >> 15) & 0xffff);
+	uint32_t fc1 = (uint32_t)(reg & CART_FC1_MASK);
+	char *cart;
+	int rt = 0;
+
+	if ( op < CART_OP_MAXVAL ) {
+		mem->ops[op]++;
+	}
+
+	// Every operation but INITMS needs a memory system that is on
+	if ( (op != CART_OP_INITMS) && (op < CART_OP_MAXVAL) && !mem->on ) {
+		logMessage( LOG_ERROR_LEVEL, "CART BUS FAULT: opcode %u in uninitialized system", op );
+		op = CART_OP_MAXVAL;
+	}
+
+	cart = (mem->loaded < CART_MAX_CARTRIDGES) ? mem->carts[mem->loaded] : NULL;
+	switch ( op ) {
+
+	case CART_OP_INITMS: // Power on, with what the backing store kept
+		if ( mem->on ) {
+			logMessage( LOG_ERROR_LEVEL, "CART INIT: fail, initializing an initialized system" );
+			rt = 1;
+			break;
+		}
+		if ( backing && (cart_load_backing(mem) == -1) ) {
+			rt = 1;
+			break;
+		}
+		mem->on = 1;
+		mem->loaded = CART_NO_CARTRIDGE;
+		break;
+
+	case CART_OP_BZERO: // A cartridge with no memory reads as zeros
+		if ( mem->loaded == CART_NO_CARTRIDGE ) {
+			logMessage( LOG_ERROR_LEVEL, "CART BZERO: trying to zero with no active cartridge" );
+			rt = 1;
+			break;
+		}
+		free( cart );
+		mem->carts[mem->loaded] = NULL;
+		break;
+
+	case CART_OP_LDCART:
+		if ( ct1 >= CART_MAX_CARTRIDGES ) {
+			logMessage( LOG_ERROR_LEVEL, "CART LDCART: load cartridge, bad number %u", ct1 );
+			rt = 1;
+			break;
+		}
+		mem->loaded = ct1;
+		break;
+
+	case CART_OP_RDFRME:
+		if ( (mem->loaded == CART_NO_CARTRIDGE) || (fm1 >= CART_CARTRIDGE_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART RDFRME: frame read, bad frame number %u", fm1 );
+			memset( frame, 0, CART_FRAME_SIZE );
+			rt = 1;
+			break;
+		}
+		if ( cart == NULL ) {
+			memset( frame, 0, CART_FRAME_SIZE );
+		} else {
+			memcpy( frame, cart+(size_t)fm1*CART_FRAME_SIZE, CART_FRAME_SIZE );
+		}
+		break;
+
+	case CART_OP_WRFRME:
+		if ( (mem->loaded == CART_NO_CARTRIDGE) || (fm1 >= CART_CARTRIDGE_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART WRFRME: write frame, bad number %u", fm1 );
+			rt = 1;
+			break;
+		}
+		if ( (cart == NULL) && ((cart = mem->carts[mem->loaded] = calloc(1, CART_SERVER_CART_BYTES)) == NULL) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART WRFRME: out of memory for cartridge %u", mem->loaded );
+			rt = 1;
+			break;
+		}
+		memcpy( cart+(size_t)fm1*CART_FRAME_SIZE, frame, CART_FRAME_SIZE );
+		break;
+
+	case CART_OP_POWOFF: // Keep the memory in the backing store for the next INITMS
+		if ( backing && (cart_save_backing(mem) == -1) ) {
+			rt = 1;
+		}
+		logMessage( LOG_OUTPUT_LEVEL, "CART memory system poweroff: INITMS %lu BZERO %lu LDCART %lu RDFRME %lu WRFRME %lu RDFRMS %lu WRFRMS %lu POWOFF %lu",
+			mem->ops[CART_OP_INITMS], mem->ops[CART_OP_BZERO], mem->ops[CART_OP_LDCART],
+			mem->ops[CART_OP_RDFRME], mem->ops[CART_OP_WRFRME], mem->ops[CART_OP_RDFRMS],
+			mem->ops[CART_OP_WRFRMS], mem->ops[CART_OP_POWOFF] );
+		cart_release( mem );
+		break;
+
+	case CART_OP_RDFRMS: // A batch of none does nothing, clients ask it to see if batches work
+		if ( (fc1 > 0) && ((mem->loaded == CART_NO_CARTRIDGE) || (fm1+fc1 > CART_CARTRIDGE_SIZE)) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART RDFRMS: frames read, bad frames %u+%u", fm1, fc1 );
+			rt = 1;
+			break;
+		}
+		if ( cart == NULL ) {
+			memset( frame, 0, (size_t)fc1*CART_FRAME_SIZE );
+		} else {
+			memcpy( frame, cart+(size_t)fm1*CART_FRAME_SIZE, (size_t)fc1*CART_FRAME_SIZE );
+		}
+		break;
+
+	case CART_OP_WRFRMS:
+		if ( (fc1 > 0) && ((mem->loaded == CART_NO_CARTRIDGE) || (fm1+fc1 > CART_CARTRIDGE_SIZE)) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART WRFRMS: frames write, bad frames %u+%u", fm1, fc1 );
+			rt = 1;
+			break;
+		}
+		if ( fc1 == 0 ) {
+			break;
+		}
+		if ( (cart == NULL) && ((cart = mem->carts[mem->loaded] = calloc(1, CART_SERVER_CART_BYTES)) == NULL) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART WRFRMS: out of memory for cartridge %u", mem->loaded );
+			rt = 1;
+			break;
+		}
+		memcpy( cart+(size_t)fm1*CART_FRAME_SIZE, frame, (size_t)fc1*CART_FRAME_SIZE );
+		break;
+
+	default:
+		logMessage( LOG_ERROR_LEVEL, "CART BUS FAULT: unknown op instruction [%x]", op );
+		rt = 1;
+	}
+
+	return( (reg & ~((CartXferRegister)1 << 47)) | ((CartXferRegister)rt << 47) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_load_backing
+// Description  : Read the memory kept at the last POWOFF, a cartridge of
+//                zeros stays without memory. No backing store is not an error
+//
+// Inputs       : mem - the memory system
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_load_backing(CartMemorySystem *mem) {
+
+	// Local variables
+	static char zero[CART_SERVER_CART_BYTES];
+	FILE *fh;
+	int c;
+
+	if ( (fh = fopen(CART_SERVER_BACKING, "r")) == NULL ) {
+		logMessage( LOG_INFO_LEVEL, "CART INITMS: Not reading back file, does not exist [%s] ...", CART_SERVER_BACKING );
+		return( 0 );
+	}
+
+	for ( c=0; c<CART_MAX_CARTRIDGES; c++ ) {
+		if ( (mem->carts[c] == NULL) && ((mem->carts[c] = malloc(CART_SERVER_CART_BYTES)) == NULL) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART INITMS: out of memory for cartridge %d", c );
+			break;
+		}
+		if ( fread(mem->carts[c], CART_SERVER_CART_BYTES, 1, fh) != 1 ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure reading CART backing store [%s], error=[%s]",
+				CART_SERVER_BACKING, strerror(errno) );
+			break;
+		}
+		if ( memcmp(mem->carts[c], zero, CART_SERVER_CART_BYTES) == 0 ) {
+			free( mem->carts[c] );
+			mem->carts[c] = NULL;
+		}
+	}
+	fclose( fh );
+
+	if ( c < CART_MAX_CARTRIDGES ) {
+		cart_release( mem );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "Read the disk array contents successfully." );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_save_backing
+// Description  : Keep the memory for the next INITMS. It is written beside
+//                the backing store and renamed over it, so a failed write
+//                leaves the last one whole
+//
+// Inputs       : mem - the memory system
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_save_backing(CartMemorySystem *mem) {
+
+	// Local variables
+	static char zero[CART_SERVER_CART_BYTES];
+	char tmp[64];
+	FILE *fh;
+	int c;
+
+	snprintf( tmp, sizeof(tmp), "%s.%d", CART_SERVER_BACKING, (int)getpid() );
+	if ( (fh = fopen(tmp, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening cart backing store [%s], error=[%s]", tmp, strerror(errno) );
+		return( -1 );
+	}
+	for ( c=0; c<CART_MAX_CARTRIDGES; c++ ) {
+		if ( fwrite((mem->carts[c] != NULL) ? mem->carts[c] : zero, CART_SERVER_CART_BYTES, 1, fh) != 1 ) {
+			break;
+		}
+	}
+	if ( (fclose(fh) != 0) || (c < CART_MAX_CARTRIDGES) || (rename(tmp, CART_SERVER_BACKING) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing CART backing store [%s], error=[%s]", CART_SERVER_BACKING, strerror(errno) );
+		unlink( tmp );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "Stored the CART memory contents successfully." );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_release
+// Description  : Power a memory system off, freeing its cartridges
+//
+// Inputs       : mem - the memory system
+// Outputs      : none
+
+void cart_release(CartMemorySystem *mem) {
+
+	// Local variables
+	int c;
+
+	for ( c=0; c<CART_MAX_CARTRIDGES; c++ ) {
+		free( mem->carts[c] );
+		mem->carts[c] = NULL;
+	}
+	memset( mem->ops, 0, sizeof(mem->ops) );
+	mem->on = 0;
+	mem->loaded = CART_NO_CARTRIDGE;
+}
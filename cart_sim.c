@@ -31,17 +31,29 @@
 // Defines
 #define CART_WORKLOAD_DIR "workload"
 #define CART_SIM_MAX_OPEN_FILES 128
-#define CART_ARGUMENTS "huvl:c:i:p:"
+#define CART_SIM_SNAPSHOT_OPS 1000
+#define CART_SIM_L2_FRAMES 8192
+#define CART_ARGUMENTS "huvl:c:b:m:r:awt:T:s:i:p:W:U"
 #define USAGE \
-	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] [-b <bytes>] [-m <bytes>] [-r <policy>] [-a] [-w] [-t <file>] [-T <frames>] [-s <csvfile>] [-W <reqs>] [-U] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set the cart block cache to size <sz> (disabled for assign #2)\n" \
+	"    -b - set the cache memory budget to <bytes> (overrides -c)\n" \
+	"    -m - shrink the cache when the process memory passes <bytes>\n" \
+	"    -r - set the cache replacement policy to <policy> (lru, arc or 2q)\n" \
+	"    -a - filter cache insertions with the TinyLFU admission sketch\n" \
+	"    -w - write-back cache, frames go to the cartridges on eviction/close\n" \
+	"    -t - keep evicted frames in a second tier cache file <file>\n" \
+	"    -T - set the second tier to <frames> frames (default 8192)\n" \
+	"    -s - write cache statistics every 1000 operations to <csvfile>\n" \
 	"    -i - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -W - keep up to <reqs> requests in flight to the server (default 16)\n" \
+	"    -U - talk to the server with read/write, not io_uring\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -55,12 +67,15 @@ typedef struct {
 //
 // Global Data
 int verbose;
+FILE *stats_csv = NULL; // Cache statistics time series, if requested
 
 //
 // Functional Prototypes
 
 int simulate_CART( char *wload );             // control loop of the CART simulation
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+void write_cache_snapshot(const CartCacheStats *st); // Add a line to the statistics CSV
+void log_cache_stats(void);                   // Log the cache statistics summary
 
 //
 // Functions
@@ -78,7 +93,9 @@ int main( int argc, char *argv[] ) {
 
 	// Local variables
 	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
-	uint32_t cache_size = 0;
+	uint32_t cache_size = 0, l2_frames = CART_SIM_L2_FRAMES;
+	char *l2_file = NULL;
+	unsigned long cache_bytes = 0, memory_limit = 0;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
@@ -107,6 +124,56 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
+		case 'b': // Set the cache memory budget
+			if ( sscanf( optarg, "%lu", &cache_bytes ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cache budget [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'm': // Set the process memory ceiling
+			if ( sscanf( optarg, "%lu", &memory_limit ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad memory limit [%s]", optarg );
+			    return( -1 );
+			}
+			set_cart_cache_memory_limit( memory_limit );
+			break;
+
+		case 'r': // Set the cache replacement policy
+			if ( set_cart_cache_policy(optarg) != 0 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cache policy [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'a': // Cache admission filter
+			set_cart_cache_admission(1);
+			break;
+
+		case 'w': // Write-back cache
+			set_cart_cache_writeback(1);
+			break;
+
+		case 't': // Second tier cache file
+			l2_file = optarg;
+			break;
+
+		case 'T': // Second tier cache size
+			if ( (sscanf( optarg, "%u", &l2_frames ) != 1) || (l2_frames == 0) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad second tier size [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 's': // Cache statistics time series
+			if ( (stats_csv = fopen(optarg, "w")) == NULL ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad statistics file [%s], error: %s", optarg, strerror(errno) );
+			    return( -1 );
+			}
+			fprintf( stats_csv, "ops,hits,misses,insertions,overwrites,evictions,rejects,writebacks,demotions,l2hits,occupancy,peak,dirty\n" );
+			set_cart_cache_snapshot( CART_SIM_SNAPSHOT_OPS, write_cache_snapshot );
+			break;
+
         case 'i': // Get the IP address
             if (inet_addr(optarg) == INADDR_NONE) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
@@ -122,6 +189,18 @@ int main( int argc, char *argv[] ) {
 			}
             break;			
 
+		case 'W': // Set the client request window
+			if ( (sscanf( optarg, "%d", &cart_network_window ) != 1) || (cart_network_window < 1) ||
+			     (cart_network_window > CART_MAX_WINDOW) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad request window [%s], 1 to %d", optarg, CART_MAX_WINDOW );
+				return( -1 );
+			}
+			break;
+
+		case 'U': // Keep the client off io_uring
+			cart_network_uring = 0;
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -140,6 +219,12 @@ int main( int argc, char *argv[] ) {
 	if (cache_size != 0) {
 		set_cart_cache_size(cache_size);
 	}
+	if ( (cache_bytes != 0) && (resize_cart_cache(cache_bytes) != 0) ) {
+		return( -1 );
+	}
+	if (l2_file != NULL) {
+		set_cart_cache_l2(l2_file, l2_frames);
+	}
 
 	// If exgtracting file from data
 	if (unit_tests) {
@@ -147,7 +232,7 @@ int main( int argc, char *argv[] ) {
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
 		logMessage(LOG_INFO_LEVEL, "Running unit tests ....\n\n");
-		if ( (cartCacheUnitTest() == 0) && (cartCacheUnitTest() == 0) ) {
+		if ( (cartCacheUnitTest() == 0) && (cartCacheUnitTest() == 0) && (cartDriverUnitTest() == 0) ) {
 			logMessage(LOG_INFO_LEVEL, "Unit tests completed successfully.\n\n");
 		} else {
 			logMessage(LOG_ERROR_LEVEL, "Unit tests failed, aborting.\n\n");
@@ -172,6 +257,11 @@ int main( int argc, char *argv[] ) {
 		}
 	}
 
+	// Close out the statistics file
+	if (stats_csv != NULL) {
+		fclose( stats_csv );
+	}
+
 	// Return successfully
 	return( 0 );
 }
@@ -383,6 +473,7 @@ int simulate_CART( char *wload ) {
 		return( -1 );
 	}
 	logMessage(CartSimulatorLLevel, "CART simulator shutdown complete.");
+	log_cache_stats();
 	logMessage(LOG_OUTPUT_LEVEL, "CART simulation: all tests successful!!!.");
 
 	// Close the workload file, successfully
@@ -472,3 +563,55 @@ int validate_file(char *fname, int16_t mfh) {
 	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_cache_snapshot
+// Description  : Add a line for a cache statistics snapshot to the CSV file
+//
+// Inputs       : st - the cache counters
+// Outputs      : none
+
+void write_cache_snapshot(const CartCacheStats *st) {
+
+	fprintf( stats_csv, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%u,%u,%u\n",
+		(unsigned long long)st->ops, (unsigned long long)st->hits,
+		(unsigned long long)st->misses, (unsigned long long)st->insertions,
+		(unsigned long long)st->overwrites, (unsigned long long)st->evictions,
+		(unsigned long long)st->rejects, (unsigned long long)st->writebacks,
+		(unsigned long long)st->demotions, (unsigned long long)st->l2hits,
+		st->occupancy, st->peak, st->dirty );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_cache_stats
+// Description  : Log the summary of the cache statistics (after power off)
+//
+// Inputs       : none
+// Outputs      : none
+
+void log_cache_stats(void) {
+
+	// Local variables
+	CartCacheStats st;
+
+	if (get_cart_cache_stats(&st) != 0) {
+		return;
+	}
+	if (stats_csv != NULL) {
+		write_cache_snapshot( &st );
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "Cache: %u frames, peak %u used, %.1f%% hit rate (%llu hits, %llu misses)",
+		st.max_frames, st.peak, (st.hits+st.misses) ? 100.0*st.hits/(st.hits+st.misses) : 0.0,
+		(unsigned long long)st.hits, (unsigned long long)st.misses );
+	logMessage( LOG_OUTPUT_LEVEL, "Cache: %llu insertions, %llu overwrites, %llu evictions, %llu rejected, %llu written back",
+		(unsigned long long)st.insertions, (unsigned long long)st.overwrites,
+		(unsigned long long)st.evictions, (unsigned long long)st.rejects,
+		(unsigned long long)st.writebacks );
+	if (st.demotions != 0) {
+		logMessage( LOG_OUTPUT_LEVEL, "Cache: %llu frames demoted to the second tier, %llu hits served from it",
+			(unsigned long long)st.demotions, (unsigned long long)st.l2hits );
+	}
+}